@@ -13,69 +13,29 @@
 
 #include "lwip/sockets.h"
 
+#include "fast_connect.h"
+#include "frame_change.h"
+
 #define DEFAULT_WIFI_SSID   "WIFI_SSID"
 #define DEFAULT_WIFI_PWD    "WIFI_PASSWORD"
 #define DEFAULT_SERVER_IP   "192.168.1.1"
 #define DEFAULT_SERVER_PORT 8001
 
-static char s_wifi_ssid[32] = DEFAULT_WIFI_SSID;
-static char s_wifi_pwd[64] = DEFAULT_WIFI_PWD;
+static fast_connect_config_t s_wifi = {
+    .ssid = DEFAULT_WIFI_SSID,
+    .password = DEFAULT_WIFI_PWD,
+};
 static char s_server_ip[32] = DEFAULT_SERVER_IP;
 static int s_server_port = DEFAULT_SERVER_PORT;
+static int s_change_threshold = FRAME_CHANGE_DEFAULT_THRESHOLD;
 
 static const char *TAG = "ESP32_CAM";
 
-static void wifi_event_handler(void* arg, esp_event_base_t event_base,
-                                int32_t event_id, void* event_data)
-{
-    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        esp_wifi_connect();
-    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        esp_wifi_connect();
-        ESP_LOGI(TAG, "retry to connect to the AP");
-    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
-        ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
-    }
-}
-
 void wifi_init_sta(void)
 {
-    esp_netif_create_default_wifi_sta();
-
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    ESP_ERROR_CHECK(fast_connect_init(&s_wifi));
 
-    esp_event_handler_instance_t instance_any_id;
-    esp_event_handler_instance_t instance_got_ip;
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
-                                                        ESP_EVENT_ANY_ID,
-                                                        &wifi_event_handler,
-                                                        NULL,
-                                                        &instance_any_id));
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
-                                                        IP_EVENT_STA_GOT_IP,
-                                                        &wifi_event_handler,
-                                                        NULL,
-                                                        &instance_got_ip));
-
-    wifi_config_t wifi_config = {
-        .sta = {
-            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
-            .pmf_cfg = {
-                .capable = true,
-                .required = false
-            },
-        },
-    };
-    strncpy((char*)wifi_config.sta.ssid, s_wifi_ssid, sizeof(wifi_config.sta.ssid));
-    strncpy((char*)wifi_config.sta.password, s_wifi_pwd, sizeof(wifi_config.sta.password));
-
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
-
-    ESP_LOGI(TAG, "wifi_init_sta finished. SSID:%s", s_wifi_ssid);
+    ESP_LOGI(TAG, "wifi_init_sta finished. SSID:%s", s_wifi.ssid);
 }
 
 static camera_config_t camera_config = {
@@ -125,7 +85,6 @@ void udp_image_send_task(void *pvParameters) {
 
     struct sockaddr_in dest_addr;
     dest_addr.sin_family = AF_INET;
-    dest_addr.sin_port = htons(s_server_port);
 
     while (1) {
         camera_fb_t *pic = esp_camera_fb_get();
@@ -135,8 +94,9 @@ void udp_image_send_task(void *pvParameters) {
             continue;
         }
 
+        dest_addr.sin_port = htons(s_server_port);
         dest_addr.sin_addr.s_addr = inet_addr(s_server_ip);
-        sendto(sock, pic->buf, pic->len, 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+        frame_change_send(sock, pic, &dest_addr, s_change_threshold);
 
         esp_camera_fb_return(pic);
     }
@@ -145,25 +105,23 @@ void udp_image_send_task(void *pvParameters) {
 static void nvs_load_config(void) {
     nvs_handle_t handle;
     if (nvs_open("storage", NVS_READONLY, &handle) == ESP_OK) {
-        size_t size = sizeof(s_wifi_ssid);
-        nvs_get_str(handle, "wifi_ssid", s_wifi_ssid, &size);
-        size = sizeof(s_wifi_pwd);
-        nvs_get_str(handle, "wifi_pwd", s_wifi_pwd, &size);
-        size = sizeof(s_server_ip);
+        fast_connect_load_config(handle, &s_wifi);
+        size_t size = sizeof(s_server_ip);
         nvs_get_str(handle, "server_ip", s_server_ip, &size);
         nvs_get_i32(handle, "server_port", &s_server_port);
+        nvs_get_i32(handle, "change_thr", &s_change_threshold);
         nvs_close(handle);
-        ESP_LOGI(TAG, "Loaded config from NVS: %s:%d (SSID: %s)", s_server_ip, s_server_port, s_wifi_ssid);
+        ESP_LOGI(TAG, "Loaded config from NVS: %s:%d (SSID: %s)", s_server_ip, s_server_port, s_wifi.ssid);
     }
 }
 
 static void nvs_save_config(void) {
     nvs_handle_t handle;
     if (nvs_open("storage", NVS_READWRITE, &handle) == ESP_OK) {
-        nvs_set_str(handle, "wifi_ssid", s_wifi_ssid);
-        nvs_set_str(handle, "wifi_pwd", s_wifi_pwd);
+        fast_connect_save_config(handle, &s_wifi);
         nvs_set_str(handle, "server_ip", s_server_ip);
         nvs_set_i32(handle, "server_port", s_server_port);
+        nvs_set_i32(handle, "change_thr", s_change_threshold);
         nvs_commit(handle);
         nvs_close(handle);
         ESP_LOGI(TAG, "Saved config to NVS");
@@ -175,19 +133,21 @@ static void process_command(char *line) {
 
     if (strncmp(line, "SET_SSID:", 9) == 0) {
         char *ssid = line + 9;
-        strncpy(s_wifi_ssid, ssid, sizeof(s_wifi_ssid) - 1);
-        s_wifi_ssid[sizeof(s_wifi_ssid) - 1] = '\0';
+        strncpy(s_wifi.ssid, ssid, sizeof(s_wifi.ssid) - 1);
+        s_wifi.ssid[sizeof(s_wifi.ssid) - 1] = '\0';
         nvs_save_config();
+        fast_connect_apply(&s_wifi);
         char msg[128];
-        snprintf(msg, sizeof(msg), "[OK] SSID:%s\n", s_wifi_ssid);
+        snprintf(msg, sizeof(msg), "[OK] SSID:%s\n", s_wifi.ssid);
         uart_write_bytes(UART_NUM_0, msg, strlen(msg));
     } else if (strncmp(line, "SET_PWD:", 8) == 0) {
         char *pwd = line + 8;
-        strncpy(s_wifi_pwd, pwd, sizeof(s_wifi_pwd) - 1);
-        s_wifi_pwd[sizeof(s_wifi_pwd) - 1] = '\0';
+        strncpy(s_wifi.password, pwd, sizeof(s_wifi.password) - 1);
+        s_wifi.password[sizeof(s_wifi.password) - 1] = '\0';
         nvs_save_config();
+        fast_connect_apply(&s_wifi);
         char msg[128];
-        snprintf(msg, sizeof(msg), "[OK] PWD:%s\n", s_wifi_pwd);
+        snprintf(msg, sizeof(msg), "[OK] PWD:%s\n", s_wifi.password);
         uart_write_bytes(UART_NUM_0, msg, strlen(msg));
     } else if (strncmp(line, "SET_IP:", 7) == 0) {
         char *ip = line + 7;
@@ -204,17 +164,33 @@ static void process_command(char *line) {
         char msg[128];
         snprintf(msg, sizeof(msg), "[OK] PORT:%d\n", s_server_port);
         uart_write_bytes(UART_NUM_0, msg, strlen(msg));
+    } else if (strncmp(line, "SET_CHANGE:", 11) == 0) {
+        s_change_threshold = frame_change_parse_threshold(line + 11);
+        nvs_save_config();
+        char msg[128];
+        snprintf(msg, sizeof(msg), "[OK] CHANGE:%d\n", s_change_threshold);
+        uart_write_bytes(UART_NUM_0, msg, strlen(msg));
+    } else if (strncmp(line, "SET_STATIC:", 11) == 0) {
+        char msg[128];
+        if (fast_connect_parse_static(line + 11, &s_wifi) == ESP_OK) {
+            nvs_save_config();
+            fast_connect_apply(&s_wifi);
+            snprintf(msg, sizeof(msg), "[OK] STATIC:%s\n", s_wifi.static_ip[0] ? s_wifi.static_ip : "DHCP");
+        } else {
+            snprintf(msg, sizeof(msg), "[ERR] Expected SET_STATIC:ip[,gateway[,netmask]] or SET_STATIC:DHCP\n");
+        }
+        uart_write_bytes(UART_NUM_0, msg, strlen(msg));
     } else if (strncmp(line, "RESTART", 7) == 0) {
         uart_write_bytes(UART_NUM_0, "[SYSTEM] Restarting...\n", 23);
         vTaskDelay(pdMS_TO_TICKS(500));
         esp_restart();
     } else if (strncmp(line, "GET_CONFIG", 10) == 0) {
         char msg[256];
-        snprintf(msg, sizeof(msg), "[INFO] Current Config - SSID:%s, PWD:%s, IP:%s, Port:%d\n", 
-                 s_wifi_ssid, s_wifi_pwd, s_server_ip, s_server_port);
+        snprintf(msg, sizeof(msg), "[INFO] Current Config - SSID:%s, PWD:%s, Static:%s, IP:%s, Port:%d, Change:%d\n", 
+                 s_wifi.ssid, s_wifi.password, s_wifi.static_ip[0] ? s_wifi.static_ip : "DHCP", s_server_ip, s_server_port, s_change_threshold);
         uart_write_bytes(UART_NUM_0, msg, strlen(msg));
     } else if (strncmp(line, "HELP", 4) == 0) {
-        const char* help = "\n--- Commands ---\nSET_SSID:xxxx\nSET_PWD:xxxx\nSET_IP:x.x.x.x\nSET_PORT:xxxx\nGET_CONFIG\nRESTART\n-----------------\n";
+        const char* help = "\n--- Commands ---\nSET_SSID:xxxx\nSET_PWD:xxxx\nSET_STATIC:ip[,gw[,mask]]|DHCP\nSET_IP:x.x.x.x\nSET_PORT:xxxx\nSET_CHANGE:n (0 = send all)\nGET_CONFIG\nRESTART\n-----------------\n";
         uart_write_bytes(UART_NUM_0, help, strlen(help));
     } else {
         char msg[128];
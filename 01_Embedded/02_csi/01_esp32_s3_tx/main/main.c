@@ -4,21 +4,68 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
+#include "driver/uart.h"
+
 #include "nvs_flash.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_event.h"
 #include "esp_netif.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "esp_now.h"
 
+#include "csi_proto.h"
+
 #define ESP_NOW_CHANNEL         11
 #define CONFIG_SEND_FREQUENCY   100
 
+#ifndef TX_NODE_ID
+#define TX_NODE_ID              CSI_PROTO_MASTER_ID
+#endif
+#ifndef TX_NODE_COUNT
+#define TX_NODE_COUNT           1
+#endif
+#define TDMA_MIN_SLOT_US        1000
+#define TDMA_HOLDOVER_FRAMES    20
+
+#ifndef TX_RATE_MIN
+#define TX_RATE_MIN             20
+#endif
+#define RATE_STEP_HZ            5
+#define RATE_ADJUST_US          1000000
+#define CONTROL_TIMEOUT_US      5000000
+#define HEADROOM_LOW            200
+#define HEADROOM_HIGH           500
+
 static const char *TAG = "CSI-TX";
 
 static uint8_t s_peer_mac[ESP_NOW_ETH_ALEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 
+/*
+ * Node id and, on the master, the schedule it announces. Other nodes take
+ * node_count and rate_hz from the master's beacon, so only the id needs to be
+ * set per board.
+ */
+static int32_t s_node_id = TX_NODE_ID;
+static int32_t s_node_count = TX_NODE_COUNT;
+static int32_t s_rate_max = CONFIG_SEND_FREQUENCY;
+static int32_t s_rate_min = TX_RATE_MIN;
+static int32_t s_rate_hz = CONFIG_SEND_FREQUENCY;
+
+/* Latest server headroom relayed by the RX; only the master acts on it. */
+static volatile uint16_t s_headroom = CSI_PROTO_HEADROOM_MAX;
+static volatile int64_t s_last_control_us = 0;
+static int64_t s_last_adjust_us = 0;
+
+static esp_timer_handle_t s_slot_timer = NULL;
+static volatile int64_t s_frame_start_us = 0;
+static volatile int64_t s_last_beacon_us = 0;
+static volatile uint32_t s_frame = 0;
+static uint32_t s_seq = 0;
+static bool s_synced = false;
+static bool s_beacon_rejected = false;
+
 static void esp_now_send_cb(const uint8_t *mac_addr, esp_now_send_status_t status)
 {
     if (mac_addr == NULL) {
@@ -27,6 +74,47 @@ static void esp_now_send_cb(const uint8_t *mac_addr, esp_now_send_status_t statu
     }
 }
 
+/*
+ * A beacon marks the start of the master's frame. Reception lags transmission by
+ * the same airtime on every node, so all slots shift together and stay disjoint.
+ */
+static void esp_now_recv_cb(const esp_now_recv_info_t *info, const uint8_t *data, int len)
+{
+    if (csi_proto_is_control(data, len)) {
+        s_headroom = ((const csi_proto_control_t *)data)->headroom;
+        s_last_control_us = esp_timer_get_time();
+        return;
+    }
+
+    if (s_node_id == CSI_PROTO_MASTER_ID || !csi_proto_is_sounding(data, len)) {
+        return;
+    }
+
+    const csi_proto_sounding_t *beacon = (const csi_proto_sounding_t *)data;
+    if (beacon->node_id != CSI_PROTO_MASTER_ID) {
+        return;
+    }
+
+    /* A slot outside the master's frame would overlap the next frame, so stay quiet instead. */
+    if (beacon->node_count < 1 || beacon->node_count > CSI_PROTO_MAX_NODES || s_node_id >= beacon->node_count) {
+        if (!s_beacon_rejected) {
+            ESP_LOGW(TAG, "Master announces %d nodes, no slot for node %d; holding transmissions",
+                     (int)beacon->node_count, (int)s_node_id);
+            s_beacon_rejected = true;
+        }
+        s_last_beacon_us = 0;
+        return;
+    }
+    s_beacon_rejected = false;
+
+    int64_t now = esp_timer_get_time();
+    s_node_count = beacon->node_count;
+    s_rate_hz = beacon->rate_hz;
+    s_frame = beacon->frame;
+    s_frame_start_us = now;
+    s_last_beacon_us = now;
+}
+
 static void wifi_init(void)
 {
     esp_err_t ret = nvs_flash_init();
@@ -57,6 +145,7 @@ static void my_esp_now_init(void)
     ESP_ERROR_CHECK(esp_now_init());
 
     ESP_ERROR_CHECK(esp_now_register_send_cb(esp_now_send_cb));
+    ESP_ERROR_CHECK(esp_now_register_recv_cb(esp_now_recv_cb));
 
     esp_now_peer_info_t peer = {0};
     peer.channel = ESP_NOW_CHANNEL;
@@ -75,22 +164,252 @@ static void my_esp_now_init(void)
     ESP_LOGI(TAG, "ESP-NOW initialized and peer rate configured for CSI.");
 }
 
-void tx_task(void *pvParameter)
+/*
+ * Additive increase, multiplicative decrease of the master's rate within
+ * [s_rate_min, s_rate_max], once per second. Without control frames the rate
+ * climbs back to s_rate_max, so a node never stays throttled by a server that
+ * has gone away. The other nodes pick up the new rate from the next beacon.
+ */
+static void adjust_rate(int64_t now)
+{
+    if (now - s_last_adjust_us < RATE_ADJUST_US) {
+        return;
+    }
+    s_last_adjust_us = now;
+
+    bool stale = s_last_control_us == 0 || now - s_last_control_us > CONTROL_TIMEOUT_US;
+    uint16_t headroom = stale ? CSI_PROTO_HEADROOM_MAX : s_headroom;
+    int32_t rate = s_rate_hz;
+
+    if (headroom < HEADROOM_LOW) {
+        rate = rate * 3 / 4;
+    } else if (headroom > HEADROOM_HIGH) {
+        rate += RATE_STEP_HZ;
+    }
+    rate = rate < s_rate_min ? s_rate_min : rate > s_rate_max ? s_rate_max : rate;
+
+    if (rate != s_rate_hz) {
+        ESP_LOGI(TAG, "Rate %d -> %d Hz (headroom %u%s)", (int)s_rate_hz, (int)rate,
+                 (unsigned)headroom, stale ? ", no control" : "");
+        s_rate_hz = rate;
+    }
+}
+
+/*
+ * Sends this node's sounding frame and arms the timer for its slot in the next
+ * frame. The master free-runs; the other nodes re-anchor on every beacon and keep
+ * their slot for TDMA_HOLDOVER_FRAMES frames without one before going quiet.
+ */
+static void slot_timer_cb(void *arg)
 {
-    uint8_t empty_data = 0;
+    int64_t now = esp_timer_get_time();
+    uint32_t frame_us = csi_proto_frame_us(s_rate_hz);
+    uint32_t slot_us = csi_proto_slot_us(s_rate_hz, s_node_count);
+    bool is_master = s_node_id == CSI_PROTO_MASTER_ID;
+
+    if (is_master) {
+        if (s_frame_start_us == 0) {
+            s_frame_start_us = now;
+        }
+        adjust_rate(now);
+        frame_us = csi_proto_frame_us(s_rate_hz);
+        slot_us = csi_proto_slot_us(s_rate_hz, s_node_count);
+    } else if (s_last_beacon_us == 0 || now - s_last_beacon_us > (int64_t)frame_us * TDMA_HOLDOVER_FRAMES) {
+        if (s_synced) {
+            ESP_LOGW(TAG, "Lost master beacon, holding transmissions");
+            s_synced = false;
+        }
+        esp_timer_start_once(s_slot_timer, frame_us);
+        return;
+    } else if (!s_synced) {
+        ESP_LOGI(TAG, "Synced to master: %d nodes at %d Hz, slot %lu us",
+                 (int)s_node_count, (int)s_rate_hz, (unsigned long)slot_us);
+        s_synced = true;
+    }
+
+    /* Advance the last known frame start to the frame that contains now. */
+    int64_t frame_start = s_frame_start_us;
+    uint32_t frame = s_frame;
+    if (now > frame_start) {
+        int64_t elapsed = (now - frame_start) / frame_us;
+        frame_start += elapsed * frame_us;
+        frame += elapsed;
+    }
+    if (is_master) {
+        s_frame_start_us = frame_start;
+        s_frame = frame;
+    }
+
+    /* Only send if we woke inside our own slot; a late wakeup skips the frame. */
+    int64_t slot_start = frame_start + (int64_t)slot_us * s_node_id;
+    if (now >= slot_start && now < slot_start + slot_us) {
+        csi_proto_sounding_t payload = {
+            .magic      = CSI_PROTO_MAGIC,
+            .version    = CSI_PROTO_VERSION,
+            .node_id    = s_node_id,
+            .node_count = s_node_count,
+            .rate_hz    = s_rate_hz,
+            .frame      = frame,
+            .seq        = s_seq++,
+            .tx_time_us = (uint32_t)esp_timer_get_time(),
+        };
+        esp_now_send(s_peer_mac, (const uint8_t *)&payload, sizeof(payload));
+    }
+
+    int64_t next = slot_start;
+    while (next <= now) {
+        next += frame_us;
+    }
+    int64_t delay = next - esp_timer_get_time();
+    esp_timer_start_once(s_slot_timer, delay > 0 ? delay : 0);
+}
+
+static void tdma_start(void)
+{
+    if (s_node_count < 1 || s_node_count > CSI_PROTO_MAX_NODES || s_node_id < 0 || s_node_id >= s_node_count) {
+        ESP_LOGE(TAG, "Invalid TDMA config: node %d of %d", (int)s_node_id, (int)s_node_count);
+        return;
+    }
+    if (csi_proto_slot_us(s_rate_max, s_node_count) < TDMA_MIN_SLOT_US) {
+        s_rate_max = 1000000 / (TDMA_MIN_SLOT_US * s_node_count);
+        ESP_LOGW(TAG, "Slots shorter than %d us, rate lowered to %d Hz", TDMA_MIN_SLOT_US, (int)s_rate_max);
+    }
+    if (s_rate_min < 1 || s_rate_min > s_rate_max) {
+        s_rate_min = s_rate_max;
+    }
+    s_rate_hz = s_rate_max;
+
+    const esp_timer_create_args_t timer_args = {
+        .callback        = slot_timer_cb,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name            = "tdma_slot",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &s_slot_timer));
+    ESP_ERROR_CHECK(esp_timer_start_once(s_slot_timer, 0));
+
+    ESP_LOGI(TAG, "TDMA node %d of %d at %d Hz per node%s", (int)s_node_id, (int)s_node_count,
+             (int)s_rate_hz, s_node_id == CSI_PROTO_MASTER_ID ? " (master)" : "");
+}
+
+static void nvs_load_config(void) {
+    nvs_handle_t handle;
+    if (nvs_open("storage", NVS_READONLY, &handle) == ESP_OK) {
+        nvs_get_i32(handle, "node_id", &s_node_id);
+        nvs_get_i32(handle, "node_count", &s_node_count);
+        nvs_get_i32(handle, "rate_hz", &s_rate_max);
+        nvs_get_i32(handle, "rate_min", &s_rate_min);
+        nvs_close(handle);
+        ESP_LOGI(TAG, "Loaded config from NVS: node %d of %d at %d-%d Hz",
+                 (int)s_node_id, (int)s_node_count, (int)s_rate_min, (int)s_rate_max);
+    }
+}
+
+static void nvs_save_config(void) {
+    nvs_handle_t handle;
+    if (nvs_open("storage", NVS_READWRITE, &handle) == ESP_OK) {
+        nvs_set_i32(handle, "node_id", s_node_id);
+        nvs_set_i32(handle, "node_count", s_node_count);
+        nvs_set_i32(handle, "rate_hz", s_rate_max);
+        nvs_set_i32(handle, "rate_min", s_rate_min);
+        nvs_commit(handle);
+        nvs_close(handle);
+        ESP_LOGI(TAG, "Saved config to NVS");
+    }
+}
+
+static void process_command(char *line) {
+    if (strlen(line) == 0) return;
+
+    if (strncmp(line, "SET_NODE_ID:", 12) == 0) {
+        s_node_id = atoi(line + 12);
+        nvs_save_config();
+        char msg[128];
+        snprintf(msg, sizeof(msg), "[OK] NODE_ID:%d\n", (int)s_node_id);
+        uart_write_bytes(UART_NUM_0, msg, strlen(msg));
+    } else if (strncmp(line, "SET_NODE_COUNT:", 15) == 0) {
+        s_node_count = atoi(line + 15);
+        nvs_save_config();
+        char msg[128];
+        snprintf(msg, sizeof(msg), "[OK] NODE_COUNT:%d\n", (int)s_node_count);
+        uart_write_bytes(UART_NUM_0, msg, strlen(msg));
+    } else if (strncmp(line, "SET_RATE:", 9) == 0) {
+        s_rate_max = atoi(line + 9);
+        nvs_save_config();
+        char msg[128];
+        snprintf(msg, sizeof(msg), "[OK] RATE:%d\n", (int)s_rate_max);
+        uart_write_bytes(UART_NUM_0, msg, strlen(msg));
+    } else if (strncmp(line, "SET_RATE_MIN:", 13) == 0) {
+        s_rate_min = atoi(line + 13);
+        nvs_save_config();
+        char msg[128];
+        snprintf(msg, sizeof(msg), "[OK] RATE_MIN:%d\n", (int)s_rate_min);
+        uart_write_bytes(UART_NUM_0, msg, strlen(msg));
+    } else if (strncmp(line, "RESTART", 7) == 0) {
+        uart_write_bytes(UART_NUM_0, "[SYSTEM] Restarting...\n", 23);
+        vTaskDelay(pdMS_TO_TICKS(500));
+        esp_restart();
+    } else if (strncmp(line, "GET_CONFIG", 10) == 0) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "[INFO] Current Config - NODE_ID:%d, NODE_COUNT:%d, RATE:%d (min %d, now %d), Synced:%d\n",
+                 (int)s_node_id, (int)s_node_count, (int)s_rate_max, (int)s_rate_min, (int)s_rate_hz,
+                 s_node_id == CSI_PROTO_MASTER_ID || s_synced);
+        uart_write_bytes(UART_NUM_0, msg, strlen(msg));
+    } else if (strncmp(line, "HELP", 4) == 0) {
+        const char* help = "\n--- Commands ---\nSET_NODE_ID:n\nSET_NODE_COUNT:n\nSET_RATE:hz\nSET_RATE_MIN:hz\nGET_CONFIG\nRESTART\n-----------------\n";
+        uart_write_bytes(UART_NUM_0, help, strlen(help));
+    } else {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "[ERR] Unknown command: %s\n", line);
+        uart_write_bytes(UART_NUM_0, msg, strlen(msg));
+    }
+}
+
+void uart_console_task(void *pvParameters) {
+    uint8_t *buf = (uint8_t *) malloc(1024);
+    char line[128];
+    int line_idx = 0;
+
+    uart_write_bytes(UART_NUM_0, "\n[SYSTEM] ESP32-S3 TX Ready. Type HELP for commands.\n", 53);
 
     while (1) {
-        esp_now_send(s_peer_mac, &empty_data, sizeof(empty_data));
-        
-        vTaskDelay(pdMS_TO_TICKS(1000 / CONFIG_SEND_FREQUENCY));
+        int len = uart_read_bytes(UART_NUM_0, buf, 1024, 20 / portTICK_PERIOD_MS);
+        for (int i = 0; i < len; i++) {
+            if (buf[i] == '\n' || buf[i] == '\r') {
+                if (line_idx > 0) {
+                    line[line_idx] = '\0';
+                    process_command(line);
+                    line_idx = 0;
+                }
+            } else {
+                if (line_idx < sizeof(line) - 1) {
+                    line[line_idx++] = buf[i];
+                }
+            }
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
     }
+    free(buf);
 }
 
 void app_main(void)
 {
     wifi_init();
-    
+    nvs_load_config();
+
     my_esp_now_init();
 
-    xTaskCreate(tx_task, "tx_task", 4096, NULL, 5, NULL);
-}
\ No newline at end of file
+    uart_config_t uart0_config = {
+        .baud_rate = 115200,
+        .data_bits = UART_DATA_8_BITS,
+        .parity    = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_DEFAULT,
+    };
+    uart_driver_install(UART_NUM_0, 1024, 0, 0, NULL, 0);
+    uart_param_config(UART_NUM_0, &uart0_config);
+
+    tdma_start();
+
+    xTaskCreate(uart_console_task, "uart_console_task", 4096, NULL, 1, NULL);
+}
@@ -4,6 +4,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 
 #include "driver/uart.h"
 #include "driver/gpio.h"
@@ -14,6 +15,17 @@
 #include "esp_event.h"
 #include "esp_wifi.h"
 #include "esp_now.h"
+#include "esp_timer.h"
+
+#include "csi_proto.h"
+#include "csi_layout.h"
+
+#if RX_LATENT_UPLINK
+#include "vae_encoder.h"
+#ifndef VAE_ENCODER_HAS_WEIGHTS
+#error "RX_LATENT_UPLINK needs vae_encoder_weights.h, see 02_Server/02_Streaming/export_encoder.py"
+#endif
+#endif
 
 #define ESP_NOW_CHANNEL 11 
 
@@ -23,55 +35,444 @@
 #define RXD_PIN         GPIO_NUM_2
 #define BUF_SIZE        2048
 
+#ifndef CSI_QUEUE_LEN
+#define CSI_QUEUE_LEN       64
+#endif
+_Static_assert(CSI_QUEUE_LEN <= 255, "CSI pool slots are indexed with uint8_t");
+#ifndef CSI_MAX_LEN
+#define CSI_MAX_LEN         CSI_LAYOUT_MAX_LEN
+#endif
+#ifndef UART_TX_RING_SIZE
+#define UART_TX_RING_SIZE   (32 * 1024)
+#endif
+#ifndef CSI_TASK_CORE
+#define CSI_TASK_CORE       1
+#endif
+#ifndef CSI_TASK_PRIORITY
+#define CSI_TASK_PRIORITY   12
+#endif
+/* 1: run the VAE encoder here and send LATENT lines instead of raw CSI. */
+#ifndef RX_LATENT_UPLINK
+#define RX_LATENT_UPLINK    0
+#endif
+#define LATENT_HOP          50
+/* A CSI sample and the sounding payload of the same packet arrive this close together. */
+#define PAIR_WINDOW_US      2000
+/* Held samples of a TX that has gone quiet are forwarded after at most this long. */
+#define PAIR_FLUSH_US       100000
+#define STATS_INTERVAL_MS   5000
+#define CONTROL_PREFIX      "HEADROOM:"
+
 #define TAG             "CSI-RX"
 
+typedef struct {
+    wifi_pkt_rx_ctrl_t rx_ctrl;
+    uint8_t mac[6];
+    int8_t tx_id;
+    bool has_seq;
+    uint32_t seq;
+    uint32_t tx_time_us;
+    int64_t rx_seq;
+    bool first_word_invalid;
+    uint16_t len;
+    int8_t buf[CSI_MAX_LEN];
+} csi_record_t;
+
+/*
+ * CSI records live in a fixed pool. The Wi-Fi task only copies into a free slot
+ * and queues its index, so the callback never allocates and never waits on UART.
+ */
+static csi_record_t s_csi_pool[CSI_QUEUE_LEN];
+static QueueHandle_t s_free_queue = NULL;
 static QueueHandle_t s_csi_queue = NULL;
 
-static const char *const CSI_PREFIX_FORMAT = "\"" MACSTR "\",%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,\"[%d";
-static const char *const CSI_SUFFIX_FORMAT = "]\"\n";
-static const char *const CSI_BUF_ELEMENT_FORMAT = ",%d";
+static const wifi_csi_config_t s_csi_config = {
+    .lltf_en           = false,
+    .htltf_en          = true,
+    .stbc_htltf2_en    = false,
+    .ltf_merge_en      = true,
+    .channel_filter_en = true,
+    .manu_scale        = false,
+    .shift             = true,
+};
+
+/* Expected buffer layout per packet mode under s_csi_config. */
+static csi_layout_t s_layouts[CSI_MODE_COUNT];
+
+/*
+ * Node id announced by each TX in its sounding payload, learned as frames arrive.
+ * A CSI sample is held in pending until the payload of the same packet tags it
+ * with the TX sequence number and timestamp; records counts what was queued
+ * from this TX, so gaps in it downstream are UART or network loss.
+ */
+typedef struct {
+    uint8_t mac[6];
+    int8_t node_id;
+    int16_t pending;
+    int64_t pending_us;
+    bool payload_valid;
+    int64_t payload_us;
+    uint32_t payload_seq;
+    uint32_t payload_tx_time_us;
+    uint32_t records;
+} tx_node_t;
+
+static const uint8_t s_broadcast_mac[ESP_NOW_ETH_ALEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+static tx_node_t s_tx_nodes[CSI_PROTO_MAX_NODES];
+static volatile uint8_t s_tx_node_count = 0;
+static SemaphoreHandle_t s_pair_lock = NULL;
+
+static uint32_t s_queue_peak = 0;
+static portMUX_TYPE s_stats_mux = portMUX_INITIALIZER_UNLOCKED;
+static volatile uint32_t s_drop_queue = 0;
+static volatile uint32_t s_drop_uart = 0;
+static volatile uint32_t s_drop_layout = 0;
+static volatile uint32_t s_records_sent = 0;
+static volatile uint32_t s_bytes_sent = 0;
+
+static const char *const CSI_PREFIX_FORMAT = "\"" MACSTR "\",%d,%lld,%lld,%lld,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%lu,%d,%d,%d,%d,%d,\"[";
+static const char CSI_SUFFIX[] = "]\"\n";
+
+static inline char *append_int(char *p, int value)
+{
+    char tmp[4];
+    int n = 0;
+    unsigned int v = value < 0 ? -value : value;
+
+    if (value < 0) {
+        *p++ = '-';
+    }
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n) {
+        *p++ = tmp[--n];
+    }
+    return p;
+}
+
+static int format_csi_record(const csi_record_t *record, char *out, size_t size)
+{
+    const wifi_pkt_rx_ctrl_t *rx_ctrl = &record->rx_ctrl;
+
+    int len = snprintf(out, size,
+        CSI_PREFIX_FORMAT,
+        MAC2STR(record->mac), record->tx_id,
+        record->has_seq ? (long long)record->seq : -1LL,
+        record->has_seq ? (long long)record->tx_time_us : -1LL,
+        (long long)record->rx_seq,
+        rx_ctrl->rssi, rx_ctrl->rate, rx_ctrl->sig_mode, rx_ctrl->mcs,
+        rx_ctrl->cwb, rx_ctrl->smoothing, rx_ctrl->not_sounding,
+        rx_ctrl->aggregation, rx_ctrl->stbc, rx_ctrl->fec_coding,
+        rx_ctrl->sgi, rx_ctrl->noise_floor, rx_ctrl->ampdu_cnt,
+        rx_ctrl->channel, rx_ctrl->secondary_channel, (unsigned long)rx_ctrl->timestamp,
+        rx_ctrl->ant, rx_ctrl->sig_len, rx_ctrl->rx_state,
+        record->len, record->first_word_invalid);
+
+    /* Each element takes at most 5 bytes (",-128"). */
+    if (len < 0 || len + record->len * 5 + sizeof(CSI_SUFFIX) > size) {
+        return -1;
+    }
+
+    char *p = out + len;
+    for (int i = 0; i < record->len; i++) {
+        if (i > 0) {
+            *p++ = ',';
+        }
+        p = append_int(p, record->buf[i]);
+    }
+    memcpy(p, CSI_SUFFIX, sizeof(CSI_SUFFIX) - 1);
+    p += sizeof(CSI_SUFFIX) - 1;
+
+    return p - out;
+}
+
+#if RX_LATENT_UPLINK
+typedef struct {
+    uint8_t mac[6];
+    bool used;
+    uint16_t since_latent;
+    vae_encoder_window_t window;
+} latent_source_t;
+
+static latent_source_t s_latent_sources[CSI_PROTO_MAX_NODES];
+
+static latent_source_t *find_latent_source(const uint8_t *mac)
+{
+    latent_source_t *free_source = NULL;
+    for (int i = 0; i < CSI_PROTO_MAX_NODES; i++) {
+        if (s_latent_sources[i].used && memcmp(s_latent_sources[i].mac, mac, 6) == 0) {
+            return &s_latent_sources[i];
+        }
+        if (!s_latent_sources[i].used && !free_source) {
+            free_source = &s_latent_sources[i];
+        }
+    }
+    if (free_source) {
+        free_source->used = true;
+        free_source->since_latent = 0;
+        memcpy(free_source->mac, mac, 6);
+        vae_encoder_window_reset(&free_source->window);
+    }
+    return free_source;
+}
+
+/*
+ * Feeds one record into its transmitter's window and, every LATENT_HOP frames
+ * once the window is full, formats the latent mean as
+ * LATENT,"mac",tx_id,seq,timestamp,scale,"[q0,...]". Returns 0 when there is
+ * nothing to send.
+ */
+static int format_latent_record(const csi_record_t *record, char *out, size_t size)
+{
+    if (record->len != CSI_LEGACY_BUFFER_LEN) {
+        return -1;
+    }
+
+    latent_source_t *source = find_latent_source(record->mac);
+    if (!source) {
+        return -1;
+    }
+
+    float amplitude[CSI_LEGACY_NUM_SUBCARRIERS];
+    csi_layout_legacy_amplitude(record->buf, amplitude);
+    vae_encoder_push(&source->window, amplitude);
+
+    if (!vae_encoder_ready(&source->window) || ++source->since_latent < LATENT_HOP) {
+        return 0;
+    }
+    source->since_latent = 0;
+
+    int8_t mu[VAE_ENC_LATENT];
+    vae_encoder_latent(&source->window, mu);
+
+    int len = snprintf(out, size, "LATENT,\"" MACSTR "\",%d,%lld,%lu,%.6g,\"[",
+                       MAC2STR(record->mac), record->tx_id, record->has_seq ? (long long)record->seq : -1LL,
+                       (unsigned long)record->rx_ctrl.timestamp, vae_encoder_latent_scale());
+    if (len < 0 || len + VAE_ENC_LATENT * 5 + sizeof(CSI_SUFFIX) > size) {
+        return -1;
+    }
+
+    char *p = out + len;
+    for (int i = 0; i < VAE_ENC_LATENT; i++) {
+        if (i > 0) {
+            *p++ = ',';
+        }
+        p = append_int(p, mu[i]);
+    }
+    memcpy(p, CSI_SUFFIX, sizeof(CSI_SUFFIX) - 1);
+    p += sizeof(CSI_SUFFIX) - 1;
+
+    return p - out;
+}
+#endif
 
+/*
+ * Formats queued records and hands them to the UART driver's TX ring, which the
+ * UART ISR drains in the background. A record that does not fit in the ring is
+ * dropped and counted instead of blocking the pipeline.
+ */
 void serial_sender_task(void *pvParameter) {
-    wifi_csi_info_t info;
-    wifi_pkt_rx_ctrl_t *rx_ctrl;
+    uint8_t slot;
 
-    char *data_to_send = malloc(BUF_SIZE);
+    char *data_to_send = malloc(BUF_SIZE + CSI_MAX_LEN * 5);
     if (!data_to_send) {
         ESP_LOGE(TAG, "Failed to allocate memory for UART send buffer. Task aborting.");
         vTaskDelete(NULL);
         return;
     }
-    
+
     while(1) {
-        if (xQueueReceive(s_csi_queue, &info, portMAX_DELAY) == pdPASS) {
-            rx_ctrl = &info.rx_ctrl;
-            int len = 0;
-
-            len = snprintf(data_to_send, BUF_SIZE,
-                CSI_PREFIX_FORMAT,
-                MAC2STR(info.mac),
-                rx_ctrl->rssi, rx_ctrl->rate, rx_ctrl->sig_mode, rx_ctrl->mcs,
-                rx_ctrl->cwb, rx_ctrl->smoothing, rx_ctrl->not_sounding,
-                rx_ctrl->aggregation, rx_ctrl->stbc, rx_ctrl->fec_coding,
-                rx_ctrl->sgi, rx_ctrl->noise_floor, rx_ctrl->ampdu_cnt,
-                rx_ctrl->channel, rx_ctrl->secondary_channel, rx_ctrl->timestamp,
-                rx_ctrl->ant, rx_ctrl->sig_len, rx_ctrl->rx_state,
-                info.len, info.first_word_invalid, info.buf[0]);
-
-            for (int i = 1; i < info.len; i++) {
-                len += snprintf(data_to_send + len, BUF_SIZE - len,
-                                CSI_BUF_ELEMENT_FORMAT, info.buf[i]);
+        if (xQueueReceive(s_csi_queue, &slot, portMAX_DELAY) == pdPASS) {
+#if RX_LATENT_UPLINK
+            int len = format_latent_record(&s_csi_pool[slot], data_to_send, BUF_SIZE + CSI_MAX_LEN * 5);
+#else
+            int len = format_csi_record(&s_csi_pool[slot], data_to_send, BUF_SIZE + CSI_MAX_LEN * 5);
+#endif
+            xQueueSend(s_free_queue, &slot, 0);
+            if (len <= 0) {
+                continue;
+            }
+
+            size_t tx_free = 0;
+            uart_get_tx_buffer_free_size(UART_PORT_NUM, &tx_free);
+            if (tx_free < (size_t)len) {
+                s_drop_uart++;
+                continue;
             }
 
-            len += snprintf(data_to_send + len, BUF_SIZE - len, CSI_SUFFIX_FORMAT);
-            
             uart_write_bytes(UART_PORT_NUM, data_to_send, len);
+            s_records_sent++;
+            s_bytes_sent += len;
+        }
+    }
+}
 
-            free(info.buf);
+/*
+ * Relays "HEADROOM:<0-1000>" lines from the gateway to the TX nodes. The
+ * gateway sits on the AP's channel and cannot reach the TX over ESP-NOW, so
+ * the control path reuses the UART link in the reverse direction.
+ */
+static void control_task(void *pvParameter)
+{
+    uint8_t buf[64];
+    char line[32];
+    int line_idx = 0;
+
+    while (1) {
+        int len = uart_read_bytes(UART_PORT_NUM, buf, sizeof(buf), portMAX_DELAY);
+        for (int i = 0; i < len; i++) {
+            if (buf[i] != '\n') {
+                if (line_idx < sizeof(line) - 1) {
+                    line[line_idx++] = buf[i];
+                }
+                continue;
+            }
+
+            line[line_idx] = '\0';
+            line_idx = 0;
+            if (strncmp(line, CONTROL_PREFIX, strlen(CONTROL_PREFIX)) != 0) {
+                continue;
+            }
+
+            int headroom = atoi(line + strlen(CONTROL_PREFIX));
+            csi_proto_control_t control = {
+                .magic    = CSI_PROTO_CONTROL_MAGIC,
+                .version  = CSI_PROTO_VERSION,
+                .headroom = headroom < 0 ? 0 : headroom > CSI_PROTO_HEADROOM_MAX ? CSI_PROTO_HEADROOM_MAX : headroom,
+            };
+            esp_now_send(s_broadcast_mac, (const uint8_t *)&control, sizeof(control));
         }
     }
 }
 
+static void stats_task(void *pvParameter)
+{
+    uint32_t last_records = 0;
+    uint32_t last_bytes = 0;
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(STATS_INTERVAL_MS));
+
+        uint32_t records = s_records_sent;
+        uint32_t bytes = s_bytes_sent;
+        taskENTER_CRITICAL(&s_stats_mux);
+        uint32_t peak = s_queue_peak;
+        s_queue_peak = 0;
+        taskEXIT_CRITICAL(&s_stats_mux);
+        ESP_LOGI(TAG, "queue %u/%d (peak %lu) | %lu rec/s, %lu B/s | dropped: queue %lu, uart %lu, layout %lu",
+                 (unsigned)uxQueueMessagesWaiting(s_csi_queue), CSI_QUEUE_LEN, (unsigned long)peak,
+                 (unsigned long)((records - last_records) * 1000 / STATS_INTERVAL_MS),
+                 (unsigned long)((bytes - last_bytes) * 1000 / STATS_INTERVAL_MS),
+                 (unsigned long)s_drop_queue, (unsigned long)s_drop_uart, (unsigned long)s_drop_layout);
+
+        last_records = records;
+        last_bytes = bytes;
+    }
+}
+
+static tx_node_t *find_tx_node(const uint8_t *mac)
+{
+    for (int i = 0; i < s_tx_node_count; i++) {
+        if (memcmp(s_tx_nodes[i].mac, mac, 6) == 0) {
+            return &s_tx_nodes[i];
+        }
+    }
+    return NULL;
+}
+
+static void queue_record(uint8_t slot, tx_node_t *node)
+{
+    s_csi_pool[slot].rx_seq = node ? node->records++ : -1;
+    xQueueSend(s_csi_queue, &slot, 0);
+
+    uint32_t waiting = uxQueueMessagesWaiting(s_csi_queue);
+    taskENTER_CRITICAL(&s_stats_mux);
+    if (waiting > s_queue_peak) {
+        s_queue_peak = waiting;
+    }
+    taskEXIT_CRITICAL(&s_stats_mux);
+}
+
+/* Queues a held sample without a payload once it can no longer be paired. */
+static void flush_pending(tx_node_t *node, int64_t now)
+{
+    if (node->pending >= 0 && now - node->pending_us > PAIR_WINDOW_US) {
+        queue_record(node->pending, node);
+        node->pending = -1;
+    }
+}
+
+/*
+ * Forwards samples held for a TX that has stopped sending, e.g. a follower in
+ * TDMA holdover or a node that was switched off; the callbacks only flush on
+ * traffic.
+ */
+static void pair_flush_cb(void *arg)
+{
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(s_pair_lock, portMAX_DELAY);
+    for (int i = 0; i < s_tx_node_count; i++) {
+        flush_pending(&s_tx_nodes[i], now);
+    }
+    xSemaphoreGive(s_pair_lock);
+}
+
+/*
+ * Both callbacks run in the Wi-Fi task and pair_flush_cb in the esp_timer task;
+ * s_pair_lock serialises their access to the table and the pending samples,
+ * and is only ever held for a few microseconds. The CSI of a packet is normally
+ * reported just before its payload; if the payload comes first it is kept for
+ * PAIR_WINDOW_US and attached when the CSI follows. The first frames of a new
+ * TX go out with tx_id -1 and no sequence number.
+ */
+static void pair_payload(const esp_now_recv_info_t *info, const csi_proto_sounding_t *frame)
+{
+    int64_t now = esp_timer_get_time();
+    tx_node_t *node = find_tx_node(info->src_addr);
+    if (!node) {
+        if (s_tx_node_count >= CSI_PROTO_MAX_NODES) {
+            return;
+        }
+        node = &s_tx_nodes[s_tx_node_count];
+        memset(node, 0, sizeof(*node));
+        memcpy(node->mac, info->src_addr, 6);
+        node->pending = -1;
+        s_tx_node_count++;
+        ESP_LOGI(TAG, "TX node %d: " MACSTR, frame->node_id, MAC2STR(info->src_addr));
+    }
+    node->node_id = frame->node_id;
+
+    flush_pending(node, now);
+    if (node->pending >= 0) {
+        csi_record_t *record = &s_csi_pool[node->pending];
+        record->has_seq = true;
+        record->seq = frame->seq;
+        record->tx_time_us = frame->tx_time_us;
+        queue_record(node->pending, node);
+        node->pending = -1;
+        node->payload_valid = false;
+    } else {
+        node->payload_valid = true;
+        node->payload_us = now;
+        node->payload_seq = frame->seq;
+        node->payload_tx_time_us = frame->tx_time_us;
+    }
+}
+
+static void esp_now_recv_cb(const esp_now_recv_info_t *info, const uint8_t *data, int len)
+{
+    if (!csi_proto_is_sounding(data, len)) {
+        return;
+    }
+
+    xSemaphoreTake(s_pair_lock, portMAX_DELAY);
+    pair_payload(info, (const csi_proto_sounding_t *)data);
+    xSemaphoreGive(s_pair_lock);
+}
+
 static void wifi_csi_rx_cb(void *ctx, wifi_csi_info_t *info)
 {
     if (!info || !info->buf) {
@@ -79,35 +480,63 @@ static void wifi_csi_rx_cb(void *ctx, wifi_csi_info_t *info)
         return;
     }
 
-    wifi_csi_info_t data_to_queue;
-    memcpy(&data_to_queue, info, sizeof(wifi_csi_info_t));
-    
-    data_to_queue.buf = malloc(info->len);
-    if (data_to_queue.buf == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for CSI buffer");
+    /* A length that does not match the packet's mode would be mis-indexed downstream. */
+    csi_mode_t mode = CSI_LAYOUT_MODE_FROM_RX_CTRL(&info->rx_ctrl);
+    if (mode == CSI_MODE_INVALID || !csi_layout_check(&s_layouts[mode], info->len)) {
+        if (s_drop_layout++ == 0) {
+            ESP_LOGW(TAG, "Unexpected CSI length %d for mode %d", info->len, (int)mode);
+        }
+        return;
+    }
+
+    uint8_t slot;
+    if (xQueueReceive(s_free_queue, &slot, 0) != pdPASS) {
+        s_drop_queue++;
         return;
     }
-    memcpy(data_to_queue.buf, info->buf, info->len);
 
-    if (xQueueSend(s_csi_queue, &data_to_queue, 0) != pdPASS) {
-        ESP_LOGW(TAG, "CSI queue is full, dropping data.");
-        free(data_to_queue.buf);
+    xSemaphoreTake(s_pair_lock, portMAX_DELAY);
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < s_tx_node_count; i++) {
+        flush_pending(&s_tx_nodes[i], now);
+    }
+
+    tx_node_t *node = find_tx_node(info->mac);
+    csi_record_t *record = &s_csi_pool[slot];
+    record->rx_ctrl = info->rx_ctrl;
+    memcpy(record->mac, info->mac, sizeof(record->mac));
+    record->tx_id = node ? node->node_id : -1;
+    record->has_seq = false;
+    record->first_word_invalid = info->first_word_invalid;
+    record->len = info->len < CSI_MAX_LEN ? info->len : CSI_MAX_LEN;
+    memcpy(record->buf, info->buf, record->len);
+
+    if (!node) {
+        queue_record(slot, NULL);
+    } else if (node->payload_valid && now - node->payload_us <= PAIR_WINDOW_US) {
+        record->has_seq = true;
+        record->seq = node->payload_seq;
+        record->tx_time_us = node->payload_tx_time_us;
+        node->payload_valid = false;
+        queue_record(slot, node);
+    } else {
+        /* Unpaired samples keep their arrival order: an older held sample goes first. */
+        if (node->pending >= 0) {
+            queue_record(node->pending, node);
+        }
+        node->payload_valid = false;
+        node->pending = slot;
+        node->pending_us = now;
     }
+    xSemaphoreGive(s_pair_lock);
 }
 
 static void csi_init(void)
 {
-    const wifi_csi_config_t csi_config = {
-        .lltf_en           = false,
-        .htltf_en          = true,
-        .stbc_htltf2_en    = false,
-        .ltf_merge_en      = true,
-        .channel_filter_en = true,
-        .manu_scale        = false,
-        .shift             = true,
-    };
+    csi_layout_table_init(s_layouts, csi_layout_flags(s_csi_config.lltf_en, s_csi_config.htltf_en,
+                                                      s_csi_config.stbc_htltf2_en));
 
-    ESP_ERROR_CHECK(esp_wifi_set_csi_config(&csi_config));
+    ESP_ERROR_CHECK(esp_wifi_set_csi_config(&s_csi_config));
     ESP_ERROR_CHECK(esp_wifi_set_csi_rx_cb(wifi_csi_rx_cb, NULL));
     ESP_ERROR_CHECK(esp_wifi_set_csi(true));
     
@@ -149,7 +578,7 @@ void uart_init() {
         .flow_ctrl  = UART_HW_FLOWCTRL_DISABLE,
         .source_clk = UART_SCLK_DEFAULT,
     };
-    uart_driver_install(UART_PORT_NUM, BUF_SIZE * 2, 0, 0, NULL, 0);
+    uart_driver_install(UART_PORT_NUM, BUF_SIZE * 2, UART_TX_RING_SIZE, 0, NULL, 0);
     uart_param_config(UART_PORT_NUM, &uart_config);
     uart_set_pin(UART_PORT_NUM, TXD_PIN, RXD_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
 }
@@ -168,17 +597,48 @@ void app_main(void) {
 
     print_mac_address();
 
-    ESP_ERROR_CHECK(esp_now_init());
+    s_pair_lock = xSemaphoreCreateMutex();
+    if (s_pair_lock == NULL) {
+        ESP_LOGE(TAG, "Failed to create pairing lock");
+        return;
+    }
 
-    s_csi_queue = xQueueCreate(16, sizeof(wifi_csi_info_t));
-    if (s_csi_queue == NULL) {
+    ESP_ERROR_CHECK(esp_now_init());
+    ESP_ERROR_CHECK(esp_now_register_recv_cb(esp_now_recv_cb));
+
+    esp_now_peer_info_t peer = {0};
+    peer.channel = ESP_NOW_CHANNEL;
+    peer.ifidx = ESP_IF_WIFI_STA;
+    peer.encrypt = false;
+    memcpy(peer.peer_addr, s_broadcast_mac, ESP_NOW_ETH_ALEN);
+    ESP_ERROR_CHECK(esp_now_add_peer(&peer));
+
+    s_free_queue = xQueueCreate(CSI_QUEUE_LEN, sizeof(uint8_t));
+    s_csi_queue = xQueueCreate(CSI_QUEUE_LEN, sizeof(uint8_t));
+    if (s_free_queue == NULL || s_csi_queue == NULL) {
         ESP_LOGE(TAG, "Failed to create CSI queue");
         return;
     }
+    for (uint8_t slot = 0; slot < CSI_QUEUE_LEN; slot++) {
+        xQueueSend(s_free_queue, &slot, 0);
+    }
 
-    csi_init();
+    const esp_timer_create_args_t flush_timer_args = {
+        .callback        = pair_flush_cb,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name            = "pair_flush",
+    };
+    esp_timer_handle_t flush_timer;
+    ESP_ERROR_CHECK(esp_timer_create(&flush_timer_args, &flush_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(flush_timer, PAIR_FLUSH_US));
 
     uart_init();
-    
-    xTaskCreate(&serial_sender_task, "serial_sender_task", 4096, NULL, 5, NULL);
+
+    /* Wi-Fi runs on core 0 (sdkconfig.defaults), so formatting gets core 1 to itself. */
+    xTaskCreatePinnedToCore(&serial_sender_task, "serial_sender_task", RX_LATENT_UPLINK ? 8192 : 4096, NULL,
+                            CSI_TASK_PRIORITY, NULL, CSI_TASK_CORE);
+    xTaskCreate(&control_task, "control_task", 3072, NULL, 2, NULL);
+    xTaskCreatePinnedToCore(&stats_task, "stats_task", 3072, NULL, 1, NULL, CSI_TASK_CORE);
+
+    csi_init();
 }
@@ -0,0 +1,340 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_partition.h"
+
+#include "csi_spool.h"
+
+#define TAG                     "CSI-SPOOL"
+
+#define SPOOL_MAGIC             0xC51D
+#define SPOOL_WRAP              0xC5FF
+#define SPOOL_ALIGN(n)          (((n) + 3) & ~3u)
+#define SPOOL_RAM_FALLBACK      (64 * 1024)
+#define SPOOL_PARTITION_LABEL   "csi_spool"
+#define SPOOL_ERASE_AHEAD       8
+
+typedef struct {
+    uint16_t magic;
+    uint16_t len;
+    uint32_t time_ms;
+} spool_hdr_t;
+
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t head;
+    size_t tail;
+    size_t used;
+    uint32_t records;
+} ram_ring_t;
+
+typedef struct {
+    const esp_partition_t *part;
+    size_t sector_size;
+    size_t sectors;
+    size_t head_sector;
+    size_t head_off;
+    size_t tail_sector;
+    size_t tail_off;
+    size_t erased;          /* sectors after head_sector that are erased and ready */
+    uint32_t records;
+} flash_ring_t;
+
+static SemaphoreHandle_t s_lock = NULL;
+static ram_ring_t s_ram;
+static flash_ring_t s_flash;
+static uint32_t s_dropped = 0;
+
+static inline uint32_t now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static bool ram_push(const spool_hdr_t *hdr, const char *data)
+{
+    size_t total = SPOOL_ALIGN(sizeof(*hdr) + hdr->len);
+    size_t skip = 0;
+
+    if (s_ram.size - s_ram.head < total) {
+        skip = s_ram.size - s_ram.head;
+    }
+    if (skip + total > s_ram.size - s_ram.used) {
+        return false;
+    }
+
+    if (skip > 0) {
+        if (skip >= sizeof(spool_hdr_t)) {
+            spool_hdr_t wrap = { .magic = SPOOL_WRAP };
+            memcpy(s_ram.buf + s_ram.head, &wrap, sizeof(wrap));
+        }
+        s_ram.used += skip;
+        s_ram.head = 0;
+    }
+
+    memcpy(s_ram.buf + s_ram.head, hdr, sizeof(*hdr));
+    memcpy(s_ram.buf + s_ram.head + sizeof(*hdr), data, hdr->len);
+    s_ram.head = (s_ram.head + total) % s_ram.size;
+    s_ram.used += total;
+    s_ram.records++;
+    return true;
+}
+
+/* Reads the oldest record into out (if not NULL) and removes it only if consume is set. */
+static size_t ram_read(char *out, size_t out_size, spool_hdr_t *hdr, bool consume)
+{
+    if (s_ram.records == 0) {
+        return 0;
+    }
+
+    size_t remain = s_ram.size - s_ram.tail;
+    if (remain < sizeof(*hdr) ||
+        ((spool_hdr_t *)(s_ram.buf + s_ram.tail))->magic == SPOOL_WRAP) {
+        s_ram.used -= remain;
+        s_ram.tail = 0;
+    }
+
+    memcpy(hdr, s_ram.buf + s_ram.tail, sizeof(*hdr));
+    size_t len = hdr->len < out_size ? hdr->len : out_size;
+    if (out) {
+        memcpy(out, s_ram.buf + s_ram.tail + sizeof(*hdr), len);
+    }
+    if (!consume) {
+        return len;
+    }
+
+    size_t total = SPOOL_ALIGN(sizeof(*hdr) + hdr->len);
+    s_ram.tail = (s_ram.tail + total) % s_ram.size;
+    s_ram.used -= total;
+    s_ram.records--;
+    return len;
+}
+
+/*
+ * The flash tier never lets a record straddle a sector, so a sector can be
+ * released in one piece once the read position leaves it. Sectors ahead of the
+ * write position are erased by csi_spool_prepare(), never here: an erase takes
+ * tens of milliseconds and push runs in the live send path.
+ */
+static bool flash_push(const spool_hdr_t *hdr, const char *data)
+{
+    if (s_flash.part == NULL) {
+        return false;
+    }
+
+    size_t total = SPOOL_ALIGN(sizeof(*hdr) + hdr->len);
+    if (total > s_flash.sector_size) {
+        return false;
+    }
+
+    if (s_flash.head_off + total > s_flash.sector_size) {
+        if (s_flash.erased == 0) {
+            return false;
+        }
+        s_flash.head_sector = (s_flash.head_sector + 1) % s_flash.sectors;
+        s_flash.head_off = 0;
+        s_flash.erased--;
+    }
+
+    size_t addr = s_flash.head_sector * s_flash.sector_size + s_flash.head_off;
+    if (esp_partition_write(s_flash.part, addr, hdr, sizeof(*hdr)) != ESP_OK ||
+        esp_partition_write(s_flash.part, addr + sizeof(*hdr), data, hdr->len) != ESP_OK) {
+        return false;
+    }
+
+    s_flash.head_off += total;
+    s_flash.records++;
+    return true;
+}
+
+static size_t flash_read(char *out, size_t out_size, spool_hdr_t *hdr, bool consume)
+{
+    if (s_flash.records == 0) {
+        return 0;
+    }
+
+    while (1) {
+        if (s_flash.tail_off + sizeof(*hdr) <= s_flash.sector_size) {
+            size_t addr = s_flash.tail_sector * s_flash.sector_size + s_flash.tail_off;
+            if (esp_partition_read(s_flash.part, addr, hdr, sizeof(*hdr)) != ESP_OK) {
+                return 0;
+            }
+            if (hdr->magic == SPOOL_MAGIC) {
+                size_t len = hdr->len < out_size ? hdr->len : out_size;
+                if (out && esp_partition_read(s_flash.part, addr + sizeof(*hdr), out, len) != ESP_OK) {
+                    return 0;
+                }
+                if (!consume) {
+                    return len;
+                }
+                s_flash.tail_off += SPOOL_ALIGN(sizeof(*hdr) + hdr->len);
+                s_flash.records--;
+                return len;
+            }
+        }
+        if (s_flash.tail_sector == s_flash.head_sector) {
+            s_flash.records = 0;
+            return 0;
+        }
+        s_flash.tail_sector = (s_flash.tail_sector + 1) % s_flash.sectors;
+        s_flash.tail_off = 0;
+    }
+}
+
+static void flash_init(void)
+{
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                           ESP_PARTITION_SUBTYPE_ANY,
+                                                           SPOOL_PARTITION_LABEL);
+    if (part == NULL) {
+        ESP_LOGI(TAG, "No '%s' partition, flash overflow disabled", SPOOL_PARTITION_LABEL);
+        return;
+    }
+
+    s_flash.part = part;
+    s_flash.sector_size = part->erase_size;
+    s_flash.sectors = part->size / part->erase_size;
+    if (s_flash.sectors < 2 ||
+        esp_partition_erase_range(part, 0, s_flash.sector_size) != ESP_OK) {
+        s_flash.part = NULL;
+        return;
+    }
+    ESP_LOGI(TAG, "Flash overflow: %u sectors of %u bytes",
+             (unsigned)s_flash.sectors, (unsigned)s_flash.sector_size);
+}
+
+esp_err_t csi_spool_init(size_t ram_bytes)
+{
+    s_lock = xSemaphoreCreateMutex();
+    if (s_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    s_ram.buf = heap_caps_malloc(ram_bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (s_ram.buf == NULL) {
+        ESP_LOGW(TAG, "PSRAM unavailable, falling back to %d bytes of internal RAM", SPOOL_RAM_FALLBACK);
+        ram_bytes = SPOOL_RAM_FALLBACK;
+        s_ram.buf = heap_caps_malloc(ram_bytes, MALLOC_CAP_8BIT);
+        if (s_ram.buf == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    s_ram.size = ram_bytes;
+
+    flash_init();
+
+    ESP_LOGI(TAG, "Spool ready: %u bytes in RAM", (unsigned)ram_bytes);
+    return ESP_OK;
+}
+
+bool csi_spool_push(const char *data, size_t len)
+{
+    if (s_lock == NULL || len == 0 || len > UINT16_MAX) {
+        return false;
+    }
+
+    spool_hdr_t hdr = {
+        .magic = SPOOL_MAGIC,
+        .len = (uint16_t)len,
+        .time_ms = now_ms(),
+    };
+
+    bool ok;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    /* Once anything sits in flash, newer records must follow it there to keep FIFO order. */
+    if (s_flash.records == 0 && ram_push(&hdr, data)) {
+        ok = true;
+    } else {
+        ok = flash_push(&hdr, data);
+    }
+    if (!ok) {
+        s_dropped++;
+    }
+    xSemaphoreGive(s_lock);
+    return ok;
+}
+
+size_t csi_spool_peek(char *out, size_t out_size, uint32_t *age_ms)
+{
+    if (s_lock == NULL) {
+        return 0;
+    }
+
+    spool_hdr_t hdr;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    size_t len = ram_read(out, out_size, &hdr, false);
+    if (len == 0) {
+        len = flash_read(out, out_size, &hdr, false);
+    }
+    xSemaphoreGive(s_lock);
+
+    if (len > 0 && age_ms) {
+        *age_ms = now_ms() - hdr.time_ms;
+    }
+    return len;
+}
+
+void csi_spool_consume(void)
+{
+    if (s_lock == NULL) {
+        return;
+    }
+
+    spool_hdr_t hdr;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_ram.records > 0) {
+        ram_read(NULL, 0, &hdr, true);
+    } else {
+        flash_read(NULL, 0, &hdr, true);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+void csi_spool_prepare(void)
+{
+    if (s_lock == NULL || s_flash.part == NULL) {
+        return;
+    }
+
+    while (1) {
+        /* Only push moves head_sector, and it consumes an erased sector when it does,
+           so next stays the same sector while the lock is released for the erase. */
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        size_t next = (s_flash.head_sector + 1 + s_flash.erased) % s_flash.sectors;
+        bool room = s_flash.erased < SPOOL_ERASE_AHEAD && next != s_flash.tail_sector;
+        xSemaphoreGive(s_lock);
+        if (!room) {
+            return;
+        }
+
+        if (esp_partition_erase_range(s_flash.part, next * s_flash.sector_size,
+                                      s_flash.sector_size) != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to erase spool sector %u", (unsigned)next);
+            return;
+        }
+
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        s_flash.erased++;
+        xSemaphoreGive(s_lock);
+    }
+}
+
+bool csi_spool_empty(void)
+{
+    return s_ram.records == 0 && s_flash.records == 0;
+}
+
+void csi_spool_get_stats(csi_spool_stats_t *stats)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    stats->records = s_ram.records + s_flash.records;
+    stats->psram_bytes = s_ram.used;
+    stats->flash_records = s_flash.records;
+    stats->dropped = s_dropped;
+    xSemaphoreGive(s_lock);
+}
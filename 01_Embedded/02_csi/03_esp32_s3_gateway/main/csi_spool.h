@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef struct {
+    uint32_t records;
+    uint32_t psram_bytes;
+    uint32_t flash_records;
+    uint32_t dropped;
+} csi_spool_stats_t;
+
+/*
+ * Bounded FIFO of framed CSI lines kept while the uplink is down.
+ * The primary tier is a ring in PSRAM (internal RAM if PSRAM is missing);
+ * once it is full, records overflow into the "csi_spool" data partition
+ * when the partition table provides one. Spooled data does not survive a reset.
+ */
+esp_err_t csi_spool_init(size_t ram_bytes);
+
+/* Returns false if both tiers are full and the record was dropped. */
+bool csi_spool_push(const char *data, size_t len);
+
+/*
+ * Copies the oldest record into out without removing it. Returns its length
+ * (0 if the spool is empty) and the time in milliseconds since it was spooled
+ * in *age_ms. Call csi_spool_consume() once the record has been delivered.
+ * Only one task may read the spool.
+ */
+size_t csi_spool_peek(char *out, size_t out_size, uint32_t *age_ms);
+
+/* Removes the record returned by the last csi_spool_peek(). */
+void csi_spool_consume(void);
+
+/*
+ * Erases flash sectors ahead of the write position so that csi_spool_push()
+ * never has to. Call it periodically from a task outside the live send path.
+ */
+void csi_spool_prepare(void);
+
+bool csi_spool_empty(void);
+
+void csi_spool_get_stats(csi_spool_stats_t *stats);
@@ -4,6 +4,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 
 #include "driver/uart.h"
 #include "driver/gpio.h"
@@ -18,6 +19,10 @@
 #include "lwip/err.h"
 #include "lwip/sockets.h"
 
+#include "fast_connect.h"
+
+#include "csi_spool.h"
+
 #define UART_BAUD_RATE  921600
 #define UART_PORT_NUM   UART_NUM_1
 #define TXD_PIN         GPIO_NUM_1
@@ -29,64 +34,176 @@
 #define DEFAULT_SERVER_IP   "192.168.1.1"
 #define DEFAULT_SERVER_PORT 8000
 
-static char s_wifi_ssid[32] = DEFAULT_WIFI_SSID;
-static char s_wifi_pwd[64] = DEFAULT_WIFI_PWD;
+#define SPOOL_RAM_BYTES     (2 * 1024 * 1024)
+#define SPOOL_DRAIN_HZ      300
+#define SPOOL_DRAIN_MS      20
+#define SPOOL_LATE_PREFIX   "LATE,"
+
+#define CONTROL_PREFIX      "HEADROOM:"
+#define CONTROL_TIMEOUT_MS  5000
+#define HEADROOM_HIGH       500
+#define BATCH_MAX_LINES     4
+#define BATCH_MAX_BYTES     4096
+#define BATCH_MAX_MS        20
+
+#define MAX_SINKS           4
+#define MAX_REPORTERS       4
+#define SINK_FAIL_LIMIT     10
+#define MULTICAST_TTL       1
+
+static fast_connect_config_t s_wifi = {
+    .ssid = DEFAULT_WIFI_SSID,
+    .password = DEFAULT_WIFI_PWD,
+};
 static char s_server_ip[32] = DEFAULT_SERVER_IP;
 static int s_server_port = DEFAULT_SERVER_PORT;
 
+static volatile bool s_uplink_up = false;
+
+/*
+ * Every CSI record is sent to each sink. Sink 0 is the SET_IP/SET_PORT server
+ * and the only one that gets spooled records replayed; ADD_SINK adds live-only
+ * consumers, which may also be a multicast group. Each sink keeps its own batch
+ * and headroom: below HEADROOM_HIGH its records are packed into fewer, larger
+ * datagrams, so a slow consumer does not change what the others receive.
+ * Every member of a multicast group reports on its own; the group's headroom
+ * is the lowest one among them, so it follows the slowest member.
+ */
+typedef struct {
+    in_addr_t addr;
+    int headroom;
+    TickType_t last_control;
+} reporter_t;
+
+typedef struct {
+    char ip[32];
+    int port;
+    struct sockaddr_in addr;
+    char batch[BATCH_MAX_BYTES];
+    int batch_len;
+    int batch_count;
+    TickType_t batch_start;
+    int batch_lines;
+    int headroom;
+    TickType_t last_control;
+    reporter_t reporters[MAX_REPORTERS];
+    uint32_t sent;
+    uint32_t errors;
+    int consecutive_errors;
+} sink_t;
+
+static sink_t s_sinks[MAX_SINKS];
+static int s_sink_count = 1;
+static SemaphoreHandle_t s_sink_lock;
+static int s_csi_sock = -1;
+
 #define TAG             "CSI-GATEWAY"
 
-static void wifi_event_handler(void* arg, esp_event_base_t event_base,
-                                int32_t event_id, void* event_data)
+static void on_link(bool up)
 {
-    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        esp_wifi_connect();
-    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        esp_wifi_connect();
-        ESP_LOGI(TAG, "retry to connect to the AP");
-    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
-        ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
-    }
+    s_uplink_up = up;
 }
 
 void wifi_init_sta(void)
 {
-    esp_netif_create_default_wifi_sta();
-
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-
-    esp_event_handler_instance_t instance_any_id;
-    esp_event_handler_instance_t instance_got_ip;
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
-                                                        ESP_EVENT_ANY_ID,
-                                                        &wifi_event_handler,
-                                                        NULL,
-                                                        &instance_any_id));
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
-                                                        IP_EVENT_STA_GOT_IP,
-                                                        &wifi_event_handler,
-                                                        NULL,
-                                                        &instance_got_ip));
-
-    wifi_config_t wifi_config = {
-        .sta = {
-            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
-            .pmf_cfg = {
-                .capable = true,
-                .required = false
-            },
-        },
-    };
-    strncpy((char*)wifi_config.sta.ssid, s_wifi_ssid, sizeof(wifi_config.sta.ssid));
-    strncpy((char*)wifi_config.sta.password, s_wifi_pwd, sizeof(wifi_config.sta.password));
+    s_wifi.on_link = on_link;
+    ESP_ERROR_CHECK(fast_connect_init(&s_wifi));
+
+    ESP_LOGI(TAG, "wifi_init_sta finished. SSID:%s", s_wifi.ssid);
+}
+
+static bool sink_is_multicast(const sink_t *sink)
+{
+    return IN_MULTICAST(ntohl(sink->addr.sin_addr.s_addr));
+}
+
+static void sink_set(sink_t *sink, const char *ip, int port)
+{
+    memset(sink, 0, sizeof(*sink));
+    strncpy(sink->ip, ip, sizeof(sink->ip) - 1);
+    sink->port = port;
+    sink->addr.sin_family = AF_INET;
+    sink->addr.sin_port = htons(port);
+    sink->addr.sin_addr.s_addr = inet_addr(ip);
+    sink->batch_lines = 1;
+    sink->headroom = -1;
+}
+
+static const char *sink_state(const sink_t *sink)
+{
+    if (sink->consecutive_errors >= SINK_FAIL_LIMIT) {
+        return "FAILING";
+    }
+    if (sink->headroom < 0) {
+        return "NO_REPORT";
+    }
+    if (xTaskGetTickCount() - sink->last_control > pdMS_TO_TICKS(CONTROL_TIMEOUT_MS)) {
+        return "SILENT";
+    }
+    return "OK";
+}
+
+static void spool_batch(const char *batch, int len)
+{
+    while (len > 0) {
+        const char *newline_ptr = memchr(batch, '\n', len);
+        int line_len = newline_ptr ? (newline_ptr - batch) + 1 : len;
+        csi_spool_push(batch, line_len);
+        batch += line_len;
+        len -= line_len;
+    }
+}
+
+static void sink_flush(int sock, int index)
+{
+    sink_t *sink = &s_sinks[index];
+    if (sink->batch_count == 0) {
+        return;
+    }
+
+    if (sendto(sock, sink->batch, sink->batch_len, 0, (struct sockaddr *)&sink->addr, sizeof(sink->addr)) < 0) {
+        sink->errors++;
+        if (++sink->consecutive_errors == SINK_FAIL_LIMIT) {
+            ESP_LOGW(TAG, "Sink %s:%d failing: errno %d", sink->ip, sink->port, errno);
+        }
+        if (index == 0) {
+            spool_batch(sink->batch, sink->batch_len);
+        }
+    } else {
+        if (sink->consecutive_errors >= SINK_FAIL_LIMIT) {
+            ESP_LOGI(TAG, "Sink %s:%d recovered", sink->ip, sink->port);
+        }
+        sink->consecutive_errors = 0;
+        sink->sent += sink->batch_count;
+    }
+    sink->batch_len = 0;
+    sink->batch_count = 0;
+}
 
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
+/* Sends a sink's pending batch before the console task changes or removes it. */
+static void sink_flush_pending(int index)
+{
+    if (s_csi_sock >= 0) {
+        sink_flush(s_csi_sock, index);
+    }
+}
 
-    ESP_LOGI(TAG, "wifi_init_sta finished. SSID:%s", s_wifi_ssid);
+static void sink_append(int sock, int index, const char *line, int len)
+{
+    sink_t *sink = &s_sinks[index];
+    if (sink->batch_len + len > sizeof(sink->batch)) {
+        sink_flush(sock, index);
+    }
+    if (sink->batch_count == 0) {
+        sink->batch_start = xTaskGetTickCount();
+    }
+    memcpy(sink->batch + sink->batch_len, line, len);
+    sink->batch_len += len;
+    sink->batch_count++;
+
+    if (sink->batch_count >= sink->batch_lines) {
+        sink_flush(sock, index);
+    }
 }
 
 static void udp_csi_send_task(void *pvParameters)
@@ -97,34 +214,46 @@ static void udp_csi_send_task(void *pvParameters)
         vTaskDelete(NULL);
         return;
     }
-    ESP_LOGI(TAG, "UDP socket created, sending to %s:%d", s_server_ip, s_server_port);
-
-    struct sockaddr_in dest_addr;
-    dest_addr.sin_family = AF_INET;
-    dest_addr.sin_port = htons(s_server_port);
+    uint8_t ttl = MULTICAST_TTL;
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    s_csi_sock = sock;
+    ESP_LOGI(TAG, "UDP socket created, sending to %d sink(s), first %s:%d", s_sink_count, s_sinks[0].ip, s_sinks[0].port);
 
     static char uart_buffer[BUF_SIZE];
     static int buffer_len = 0;
 
     while (1) {
         int len = uart_read_bytes(UART_PORT_NUM, uart_buffer + buffer_len, BUF_SIZE - buffer_len, 20 / portTICK_PERIOD_MS);
-
         if (len > 0) {
             buffer_len += len;
+        }
 
-            char *newline_ptr;
-            while ((newline_ptr = memchr(uart_buffer, '\n', buffer_len)) != NULL) {
-                int packet_len = (newline_ptr - uart_buffer) + 1;
-
-                dest_addr.sin_addr.s_addr = inet_addr(s_server_ip);
-                sendto(sock, uart_buffer, packet_len, 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+        xSemaphoreTake(s_sink_lock, portMAX_DELAY);
+        char *newline_ptr;
+        while ((newline_ptr = memchr(uart_buffer, '\n', buffer_len)) != NULL) {
+            int packet_len = (newline_ptr - uart_buffer) + 1;
 
-                buffer_len -= packet_len;
-                if (buffer_len > 0) {
-                    memmove(uart_buffer, uart_buffer + packet_len, buffer_len);
+            if (!s_uplink_up) {
+                csi_spool_push(uart_buffer, packet_len);
+            } else {
+                for (int i = 0; i < s_sink_count; i++) {
+                    sink_append(sock, i, uart_buffer, packet_len);
                 }
             }
+
+            buffer_len -= packet_len;
+            if (buffer_len > 0) {
+                memmove(uart_buffer, uart_buffer + packet_len, buffer_len);
+            }
+        }
+
+        TickType_t now = xTaskGetTickCount();
+        for (int i = 0; i < s_sink_count; i++) {
+            if (s_sinks[i].batch_count > 0 && now - s_sinks[i].batch_start >= pdMS_TO_TICKS(BATCH_MAX_MS)) {
+                sink_flush(sock, i);
+            }
         }
+        xSemaphoreGive(s_sink_lock);
 
         if (buffer_len == BUF_SIZE) {
             buffer_len = 0;
@@ -132,28 +261,232 @@ static void udp_csi_send_task(void *pvParameters)
     }
 }
 
+/*
+ * Records one reporter's headroom and returns the sink's: the lowest among
+ * reporters heard from within CONTROL_TIMEOUT_MS. A new reporter takes the
+ * slot of a silent one, or of the one heard from longest ago.
+ */
+static int sink_report(sink_t *sink, in_addr_t from, int headroom, TickType_t now)
+{
+    reporter_t *slot = NULL;
+    for (int i = 0; i < MAX_REPORTERS && slot == NULL; i++) {
+        if (sink->reporters[i].addr == from) {
+            slot = &sink->reporters[i];
+        }
+    }
+    for (int i = 0; i < MAX_REPORTERS && slot == NULL; i++) {
+        if (sink->reporters[i].addr == 0) {
+            slot = &sink->reporters[i];
+        }
+    }
+    if (slot == NULL) {
+        slot = &sink->reporters[0];
+        for (int i = 1; i < MAX_REPORTERS; i++) {
+            if (now - sink->reporters[i].last_control > now - slot->last_control) {
+                slot = &sink->reporters[i];
+            }
+        }
+    }
+    slot->addr = from;
+    slot->headroom = headroom;
+    slot->last_control = now;
+
+    int lowest = headroom;
+    for (int i = 0; i < MAX_REPORTERS; i++) {
+        const reporter_t *reporter = &sink->reporters[i];
+        if (reporter->addr != 0 && reporter->headroom < lowest &&
+            now - reporter->last_control <= pdMS_TO_TICKS(CONTROL_TIMEOUT_MS)) {
+            lowest = reporter->headroom;
+        }
+    }
+    return lowest;
+}
+
+static sink_t *sink_find(const struct sockaddr_in *from)
+{
+    for (int i = 0; i < s_sink_count; i++) {
+        sink_t *sink = &s_sinks[i];
+        if (sink->addr.sin_port != from->sin_port) {
+            continue;
+        }
+        /* Members of a multicast group answer from their own address. */
+        if (sink_is_multicast(sink) || sink->addr.sin_addr.s_addr == from->sin_addr.s_addr) {
+            return sink;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Receives HEADROOM datagrams the sinks send back to the CSI socket. A sink's
+ * batch size scales from 1 line at HEADROOM_HIGH up to BATCH_MAX_LINES at 0,
+ * and falls back to 1 when it stops reporting. The lowest headroom among the
+ * reporting sinks is relayed to the RX, which forwards it to the TX nodes so
+ * they can lower the sounding rate.
+ */
+static void control_task(void *pvParameters)
+{
+    char buf[64];
+    char relay[32];
+    struct sockaddr_in from;
+
+    while (s_csi_sock < 0) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+
+    struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+    setsockopt(s_csi_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    while (1) {
+        socklen_t from_len = sizeof(from);
+        int len = recvfrom(s_csi_sock, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&from, &from_len);
+        TickType_t now = xTaskGetTickCount();
+
+        xSemaphoreTake(s_sink_lock, portMAX_DELAY);
+        for (int i = 0; i < s_sink_count; i++) {
+            sink_t *sink = &s_sinks[i];
+            if (sink->batch_lines != 1 && now - sink->last_control > pdMS_TO_TICKS(CONTROL_TIMEOUT_MS)) {
+                ESP_LOGI(TAG, "No headroom reports from %s:%d, batching off", sink->ip, sink->port);
+                sink->batch_lines = 1;
+            }
+        }
+
+        sink_t *sink = NULL;
+        int headroom = 0;
+        if (len > 0) {
+            buf[len] = '\0';
+            if (strncmp(buf, CONTROL_PREFIX, strlen(CONTROL_PREFIX)) == 0) {
+                sink = sink_find(&from);
+            }
+        }
+        if (sink != NULL) {
+            headroom = atoi(buf + strlen(CONTROL_PREFIX));
+            headroom = headroom < 0 ? 0 : headroom > 1000 ? 1000 : headroom;
+            headroom = sink_report(sink, from.sin_addr.s_addr, headroom, now);
+            int lines = headroom >= HEADROOM_HIGH ? 1 : 1 + (HEADROOM_HIGH - headroom) * (BATCH_MAX_LINES - 1) / HEADROOM_HIGH;
+            if (lines != sink->batch_lines) {
+                ESP_LOGI(TAG, "Headroom %d from %s:%d, batching %d lines per datagram", headroom, sink->ip, sink->port, lines);
+                sink->batch_lines = lines;
+            }
+            sink->headroom = headroom;
+            sink->last_control = now;
+
+            for (int i = 0; i < s_sink_count; i++) {
+                sink_t *other = &s_sinks[i];
+                if (other->headroom >= 0 && other->headroom < headroom &&
+                    now - other->last_control <= pdMS_TO_TICKS(CONTROL_TIMEOUT_MS)) {
+                    headroom = other->headroom;
+                }
+            }
+        }
+        xSemaphoreGive(s_sink_lock);
+
+        if (sink != NULL) {
+            int relay_len = snprintf(relay, sizeof(relay), CONTROL_PREFIX "%d\n", headroom);
+            uart_write_bytes(UART_PORT_NUM, relay, relay_len);
+        }
+    }
+}
+
+/*
+ * Replays spooled records once the uplink is back. Runs below the live sender
+ * and is rate limited, so catch-up traffic only uses the leftover capacity.
+ * Records only go to sink 0, the server that records the session.
+ * Each record is prefixed with "LATE,<age_ms>," so the servers can tell it apart.
+ * The task also erases spool flash ahead of time, keeping erases out of the live path.
+ */
+static void spool_drain_task(void *pvParameters)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Unable to create spool socket: errno %d", errno);
+        vTaskDelete(NULL);
+        return;
+    }
+
+    struct sockaddr_in dest_addr;
+
+    static char record[BUF_SIZE];
+    static char packet[BUF_SIZE + 32];
+    const int per_period = SPOOL_DRAIN_HZ * SPOOL_DRAIN_MS / 1000;
+    TickType_t last_wake = xTaskGetTickCount();
+    csi_spool_stats_t stats;
+
+    while (1) {
+        csi_spool_prepare();
+        if (!s_uplink_up || csi_spool_empty()) {
+            vTaskDelay(pdMS_TO_TICKS(100));
+            last_wake = xTaskGetTickCount();
+            continue;
+        }
+
+        xSemaphoreTake(s_sink_lock, portMAX_DELAY);
+        dest_addr = s_sinks[0].addr;
+        xSemaphoreGive(s_sink_lock);
+
+        for (int i = 0; i < per_period && s_uplink_up; i++) {
+            uint32_t age_ms = 0;
+            size_t len = csi_spool_peek(record, sizeof(record), &age_ms);
+            if (len == 0) {
+                csi_spool_get_stats(&stats);
+                ESP_LOGI(TAG, "Spool drained (dropped while full: %lu)", (unsigned long)stats.dropped);
+                break;
+            }
+
+            int prefix_len = snprintf(packet, sizeof(packet), SPOOL_LATE_PREFIX "%lu,", (unsigned long)age_ms);
+            memcpy(packet + prefix_len, record, len);
+
+            /* A record stays at the head of the spool until it is sent, so replay keeps its order. */
+            if (sendto(sock, packet, prefix_len + len, 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0) {
+                break;
+            }
+            csi_spool_consume();
+        }
+
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(SPOOL_DRAIN_MS));
+    }
+}
+
 static void nvs_load_config(void) {
     nvs_handle_t handle;
     if (nvs_open("storage", NVS_READONLY, &handle) == ESP_OK) {
-        size_t size = sizeof(s_wifi_ssid);
-        nvs_get_str(handle, "wifi_ssid", s_wifi_ssid, &size);
-        size = sizeof(s_wifi_pwd);
-        nvs_get_str(handle, "wifi_pwd", s_wifi_pwd, &size);
-        size = sizeof(s_server_ip);
+        fast_connect_load_config(handle, &s_wifi);
+        size_t size = sizeof(s_server_ip);
         nvs_get_str(handle, "server_ip", s_server_ip, &size);
         nvs_get_i32(handle, "server_port", &s_server_port);
+
+        /* Extra sinks are stored as "ip:port,ip:port". */
+        char list[MAX_SINKS * 24] = "";
+        size = sizeof(list);
+        nvs_get_str(handle, "sinks", list, &size);
+        for (char *entry = strtok(list, ","); entry != NULL && s_sink_count < MAX_SINKS; entry = strtok(NULL, ",")) {
+            char *colon = strchr(entry, ':');
+            if (colon != NULL) {
+                *colon = '\0';
+                sink_set(&s_sinks[s_sink_count++], entry, atoi(colon + 1));
+            }
+        }
         nvs_close(handle);
-        ESP_LOGI(TAG, "Loaded config from NVS: %s:%d (SSID: %s)", s_server_ip, s_server_port, s_wifi_ssid);
+        ESP_LOGI(TAG, "Loaded config from NVS: %s:%d +%d sink(s) (SSID: %s)", s_server_ip, s_server_port, s_sink_count - 1, s_wifi.ssid);
     }
+    sink_set(&s_sinks[0], s_server_ip, s_server_port);
 }
 
 static void nvs_save_config(void) {
     nvs_handle_t handle;
     if (nvs_open("storage", NVS_READWRITE, &handle) == ESP_OK) {
-        nvs_set_str(handle, "wifi_ssid", s_wifi_ssid);
-        nvs_set_str(handle, "wifi_pwd", s_wifi_pwd);
+        fast_connect_save_config(handle, &s_wifi);
         nvs_set_str(handle, "server_ip", s_server_ip);
         nvs_set_i32(handle, "server_port", s_server_port);
+
+        char list[MAX_SINKS * 24] = "";
+        xSemaphoreTake(s_sink_lock, portMAX_DELAY);
+        for (int i = 1; i < s_sink_count; i++) {
+            snprintf(list + strlen(list), sizeof(list) - strlen(list), "%s%s:%d",
+                     i > 1 ? "," : "", s_sinks[i].ip, s_sinks[i].port);
+        }
+        xSemaphoreGive(s_sink_lock);
+        nvs_set_str(handle, "sinks", list);
         nvs_commit(handle);
         nvs_close(handle);
         ESP_LOGI(TAG, "Saved config to NVS");
@@ -165,24 +498,30 @@ static void process_command(char *line) {
 
     if (strncmp(line, "SET_SSID:", 9) == 0) {
         char *ssid = line + 9;
-        strncpy(s_wifi_ssid, ssid, sizeof(s_wifi_ssid) - 1);
-        s_wifi_ssid[sizeof(s_wifi_ssid) - 1] = '\0';
+        strncpy(s_wifi.ssid, ssid, sizeof(s_wifi.ssid) - 1);
+        s_wifi.ssid[sizeof(s_wifi.ssid) - 1] = '\0';
         nvs_save_config();
+        fast_connect_apply(&s_wifi);
         char msg[128];
-        snprintf(msg, sizeof(msg), "[OK] SSID:%s\n", s_wifi_ssid);
+        snprintf(msg, sizeof(msg), "[OK] SSID:%s\n", s_wifi.ssid);
         uart_write_bytes(UART_NUM_0, msg, strlen(msg));
     } else if (strncmp(line, "SET_PWD:", 8) == 0) {
         char *pwd = line + 8;
-        strncpy(s_wifi_pwd, pwd, sizeof(s_wifi_pwd) - 1);
-        s_wifi_pwd[sizeof(s_wifi_pwd) - 1] = '\0';
+        strncpy(s_wifi.password, pwd, sizeof(s_wifi.password) - 1);
+        s_wifi.password[sizeof(s_wifi.password) - 1] = '\0';
         nvs_save_config();
+        fast_connect_apply(&s_wifi);
         char msg[128];
-        snprintf(msg, sizeof(msg), "[OK] PWD:%s\n", s_wifi_pwd);
+        snprintf(msg, sizeof(msg), "[OK] PWD:%s\n", s_wifi.password);
         uart_write_bytes(UART_NUM_0, msg, strlen(msg));
     } else if (strncmp(line, "SET_IP:", 7) == 0) {
         char *ip = line + 7;
         strncpy(s_server_ip, ip, sizeof(s_server_ip) - 1);
         s_server_ip[sizeof(s_server_ip) - 1] = '\0';
+        xSemaphoreTake(s_sink_lock, portMAX_DELAY);
+        sink_flush_pending(0);
+        sink_set(&s_sinks[0], s_server_ip, s_server_port);
+        xSemaphoreGive(s_sink_lock);
         nvs_save_config();
         char msg[128];
         snprintf(msg, sizeof(msg), "[OK] IP:%s\n", s_server_ip);
@@ -190,21 +529,98 @@ static void process_command(char *line) {
     } else if (strncmp(line, "SET_PORT:", 9) == 0) {
         char *port_str = line + 9;
         s_server_port = atoi(port_str);
+        xSemaphoreTake(s_sink_lock, portMAX_DELAY);
+        sink_flush_pending(0);
+        sink_set(&s_sinks[0], s_server_ip, s_server_port);
+        xSemaphoreGive(s_sink_lock);
         nvs_save_config();
         char msg[128];
         snprintf(msg, sizeof(msg), "[OK] PORT:%d\n", s_server_port);
         uart_write_bytes(UART_NUM_0, msg, strlen(msg));
+    } else if (strncmp(line, "ADD_SINK:", 9) == 0 || strncmp(line, "DEL_SINK:", 9) == 0) {
+        bool add = line[0] == 'A';
+        char msg[128];
+        char *ip = line + 9;
+        char *colon = strchr(ip, ':');
+        int port = colon ? atoi(colon + 1) : 0;
+        if (colon != NULL) {
+            *colon = '\0';
+        }
+        if (port <= 0 || port > 65535 || inet_addr(ip) == INADDR_NONE) {
+            snprintf(msg, sizeof(msg), "[ERR] Expected %s_SINK:x.x.x.x:port\n", add ? "ADD" : "DEL");
+            uart_write_bytes(UART_NUM_0, msg, strlen(msg));
+            return;
+        }
+
+        bool changed = false;
+        xSemaphoreTake(s_sink_lock, portMAX_DELAY);
+        int found = -1;
+        for (int i = 1; i < s_sink_count; i++) {
+            if (strcmp(s_sinks[i].ip, ip) == 0 && s_sinks[i].port == port) {
+                found = i;
+            }
+        }
+        if (add && found < 0 && s_sink_count < MAX_SINKS) {
+            sink_set(&s_sinks[s_sink_count++], ip, port);
+            changed = true;
+            snprintf(msg, sizeof(msg), "[OK] SINK+%s:%d\n", ip, port);
+        } else if (!add && found > 0) {
+            sink_flush_pending(found);
+            memmove(&s_sinks[found], &s_sinks[found + 1], (s_sink_count - found - 1) * sizeof(sink_t));
+            s_sink_count--;
+            changed = true;
+            snprintf(msg, sizeof(msg), "[OK] SINK-%s:%d\n", ip, port);
+        } else if (add) {
+            snprintf(msg, sizeof(msg), "[ERR] %s\n", found < 0 ? "Sink table full" : "Sink already added");
+        } else {
+            snprintf(msg, sizeof(msg), "[ERR] No sink %s:%d\n", ip, port);
+        }
+        xSemaphoreGive(s_sink_lock);
+        if (changed) {
+            nvs_save_config();
+        }
+        uart_write_bytes(UART_NUM_0, msg, strlen(msg));
+    } else if (strncmp(line, "CLEAR_SINKS", 11) == 0) {
+        xSemaphoreTake(s_sink_lock, portMAX_DELAY);
+        for (int i = 1; i < s_sink_count; i++) {
+            sink_flush_pending(i);
+        }
+        s_sink_count = 1;
+        xSemaphoreGive(s_sink_lock);
+        nvs_save_config();
+        uart_write_bytes(UART_NUM_0, "[OK] SINKS CLEARED\n", 19);
+    } else if (strncmp(line, "LIST_SINKS", 10) == 0) {
+        char msg[160];
+        xSemaphoreTake(s_sink_lock, portMAX_DELAY);
+        for (int i = 0; i < s_sink_count; i++) {
+            const sink_t *sink = &s_sinks[i];
+            snprintf(msg, sizeof(msg), "[INFO] Sink %d: %s:%d%s %s, headroom:%d, batch:%d, sent:%lu, errors:%lu\n",
+                     i, sink->ip, sink->port, sink_is_multicast(sink) ? " (multicast)" : "", sink_state(sink),
+                     sink->headroom, sink->batch_lines, (unsigned long)sink->sent, (unsigned long)sink->errors);
+            uart_write_bytes(UART_NUM_0, msg, strlen(msg));
+        }
+        xSemaphoreGive(s_sink_lock);
+    } else if (strncmp(line, "SET_STATIC:", 11) == 0) {
+        char msg[128];
+        if (fast_connect_parse_static(line + 11, &s_wifi) == ESP_OK) {
+            nvs_save_config();
+            fast_connect_apply(&s_wifi);
+            snprintf(msg, sizeof(msg), "[OK] STATIC:%s\n", s_wifi.static_ip[0] ? s_wifi.static_ip : "DHCP");
+        } else {
+            snprintf(msg, sizeof(msg), "[ERR] Expected SET_STATIC:ip[,gateway[,netmask]] or SET_STATIC:DHCP\n");
+        }
+        uart_write_bytes(UART_NUM_0, msg, strlen(msg));
     } else if (strncmp(line, "RESTART", 7) == 0) {
         uart_write_bytes(UART_NUM_0, "[SYSTEM] Restarting...\n", 23);
         vTaskDelay(pdMS_TO_TICKS(500));
         esp_restart();
     } else if (strncmp(line, "GET_CONFIG", 10) == 0) {
         char msg[256];
-        snprintf(msg, sizeof(msg), "[INFO] Current Config - SSID:%s, PWD:%s, IP:%s, Port:%d\n", 
-                 s_wifi_ssid, s_wifi_pwd, s_server_ip, s_server_port);
+        snprintf(msg, sizeof(msg), "[INFO] Current Config - SSID:%s, PWD:%s, Static:%s, IP:%s, Port:%d, Sinks:%d\n", 
+                 s_wifi.ssid, s_wifi.password, s_wifi.static_ip[0] ? s_wifi.static_ip : "DHCP", s_server_ip, s_server_port, s_sink_count);
         uart_write_bytes(UART_NUM_0, msg, strlen(msg));
     } else if (strncmp(line, "HELP", 4) == 0) {
-        const char* help = "\n--- Commands ---\nSET_SSID:xxxx\nSET_PWD:xxxx\nSET_IP:x.x.x.x\nSET_PORT:xxxx\nGET_CONFIG\nRESTART\n-----------------\n";
+        const char* help = "\n--- Commands ---\nSET_SSID:xxxx\nSET_PWD:xxxx\nSET_STATIC:ip[,gw[,mask]]|DHCP\nSET_IP:x.x.x.x\nSET_PORT:xxxx\nADD_SINK:x.x.x.x:xxxx\nDEL_SINK:x.x.x.x:xxxx\nCLEAR_SINKS\nLIST_SINKS\nGET_CONFIG\nRESTART\n-----------------\n";
         uart_write_bytes(UART_NUM_0, help, strlen(help));
     } else {
         char msg[128];
@@ -260,6 +676,7 @@ void app_main(void) {
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
     uart_init();
+    s_sink_lock = xSemaphoreCreateMutex();
     nvs_load_config();
 
     wifi_init_sta();
@@ -275,6 +692,12 @@ void app_main(void) {
     uart_driver_install(UART_NUM_0, 1024, 0, 0, NULL, 0);
     uart_param_config(UART_NUM_0, &uart0_config);
 
+    if (csi_spool_init(SPOOL_RAM_BYTES) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to allocate the CSI spool, records are lost while offline");
+    }
+
     xTaskCreate(udp_csi_send_task, "udp_csi_send_task", 4096, NULL, 10, NULL);
+    xTaskCreate(control_task, "control_task", 3072, NULL, 5, NULL);
+    xTaskCreate(spool_drain_task, "spool_drain_task", 4096, NULL, 4, NULL);
     xTaskCreate(uart_console_task, "uart_console_task", 4096, NULL, 1, NULL);
 }
\ No newline at end of file
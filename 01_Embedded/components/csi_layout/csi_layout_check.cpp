@@ -0,0 +1,12 @@
+/*
+ * Compile-time checks of the csi_layout.h tables. The firmware includes the
+ * header from C, where the tables are not constant expressions, so they are
+ * checked here instead; nothing in this file ends up in the image.
+ */
+#include "csi_layout.h"
+
+static_assert(csi_layout::first_mismatch() == CSI_MODE_COUNT,
+              "CSI_LAYOUT_RUNS disagrees with the buffer lengths in the ESP-IDF guide");
+static_assert(csi_layout::Layout<CSI_MODE_HT40_STBC_BELOW, CSI_LAYOUT_LLTF | CSI_LAYOUT_HTLTF | CSI_LAYOUT_STBC_HTLTF>::total
+                  == CSI_LAYOUT_MAX_LEN,
+              "CSI_LAYOUT_MAX_LEN must be the longest buffer");
@@ -0,0 +1,364 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+/*
+ * Layout of the CSI buffer reported by the ESP32 / ESP32-S3 Wi-Fi driver.
+ *
+ * The buffer is a concatenation of up to three fields (LLTF, HT-LTF and
+ * STBC-HT-LTF). Which fields are present depends on the received packet
+ * (sig_mode, cwb, stbc, secondary_channel) and on the wifi_csi_config_t flags;
+ * which subcarriers each field covers depends on the packet alone. Every
+ * subcarrier is two int8 values, imaginary part first.
+ *
+ * Header-only so the same tables serve the firmware and host tools. C++ callers
+ * additionally get csi_layout::Layout<Mode, Flags>, where offsets and run bounds
+ * are compile-time constants.
+ */
+
+#ifdef __cplusplus
+#define CSI_LAYOUT_TABLE    constexpr
+#else
+#define CSI_LAYOUT_TABLE    const
+#endif
+
+#if defined(__cplusplus) || (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L)
+#define CSI_LAYOUT_RESTRICT __restrict
+#else
+#define CSI_LAYOUT_RESTRICT
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    CSI_MODE_NONHT_NONE,
+    CSI_MODE_NONHT_BELOW,
+    CSI_MODE_NONHT_ABOVE,
+    CSI_MODE_HT20_NONE,
+    CSI_MODE_HT20_BELOW,
+    CSI_MODE_HT20_ABOVE,
+    CSI_MODE_HT20_STBC_NONE,
+    CSI_MODE_HT20_STBC_BELOW,
+    CSI_MODE_HT20_STBC_ABOVE,
+    CSI_MODE_HT40_BELOW,
+    CSI_MODE_HT40_ABOVE,
+    CSI_MODE_HT40_STBC_BELOW,
+    CSI_MODE_HT40_STBC_ABOVE,
+    CSI_MODE_COUNT,
+    CSI_MODE_INVALID = CSI_MODE_COUNT,
+} csi_mode_t;
+
+typedef enum {
+    CSI_FIELD_LLTF,
+    CSI_FIELD_HTLTF,
+    CSI_FIELD_STBC_HTLTF,
+    CSI_FIELD_COUNT,
+} csi_field_t;
+
+/* Enabled fields, mirroring lltf_en / htltf_en / stbc_htltf2_en. */
+#define CSI_LAYOUT_LLTF         (1u << CSI_FIELD_LLTF)
+#define CSI_LAYOUT_HTLTF        (1u << CSI_FIELD_HTLTF)
+#define CSI_LAYOUT_STBC_HTLTF   (1u << CSI_FIELD_STBC_HTLTF)
+
+#define CSI_LAYOUT_MAX_RUNS     2
+#define CSI_LAYOUT_MAX_LEN      612
+
+/* Subcarriers first .. first + count - 1, stored back to back. */
+typedef struct {
+    int8_t first;
+    uint8_t count;
+} csi_run_t;
+
+#define CSI_RUNS_NONE       {{0, 0}, {0, 0}}
+#define CSI_RUNS_20         {{0, 32}, {-32, 32}}
+#define CSI_RUNS_BELOW      {{0, 64}, {0, 0}}
+#define CSI_RUNS_ABOVE      {{-64, 64}, {0, 0}}
+#define CSI_RUNS_BELOW_STBC {{0, 63}, {0, 0}}
+#define CSI_RUNS_ABOVE_STBC {{-62, 62}, {0, 0}}
+#define CSI_RUNS_40         {{0, 64}, {-64, 64}}
+#define CSI_RUNS_40_STBC    {{0, 61}, {-60, 60}}
+
+/* Subcarriers per field and mode, from the "Wi-Fi Channel State Information" table in the ESP-IDF guide. */
+static CSI_LAYOUT_TABLE csi_run_t CSI_LAYOUT_RUNS[CSI_MODE_COUNT][CSI_FIELD_COUNT][CSI_LAYOUT_MAX_RUNS] = {
+    /* NONHT_NONE       */ {CSI_RUNS_20,    CSI_RUNS_NONE,       CSI_RUNS_NONE},
+    /* NONHT_BELOW      */ {CSI_RUNS_BELOW, CSI_RUNS_NONE,       CSI_RUNS_NONE},
+    /* NONHT_ABOVE      */ {CSI_RUNS_ABOVE, CSI_RUNS_NONE,       CSI_RUNS_NONE},
+    /* HT20_NONE        */ {CSI_RUNS_20,    CSI_RUNS_20,         CSI_RUNS_NONE},
+    /* HT20_BELOW       */ {CSI_RUNS_BELOW, CSI_RUNS_BELOW,      CSI_RUNS_NONE},
+    /* HT20_ABOVE       */ {CSI_RUNS_ABOVE, CSI_RUNS_ABOVE,      CSI_RUNS_NONE},
+    /* HT20_STBC_NONE   */ {CSI_RUNS_20,    CSI_RUNS_20,         CSI_RUNS_20},
+    /* HT20_STBC_BELOW  */ {CSI_RUNS_BELOW, CSI_RUNS_BELOW_STBC, CSI_RUNS_BELOW_STBC},
+    /* HT20_STBC_ABOVE  */ {CSI_RUNS_ABOVE, CSI_RUNS_ABOVE_STBC, CSI_RUNS_ABOVE_STBC},
+    /* HT40_BELOW       */ {CSI_RUNS_BELOW, CSI_RUNS_40,         CSI_RUNS_NONE},
+    /* HT40_ABOVE       */ {CSI_RUNS_ABOVE, CSI_RUNS_40,         CSI_RUNS_NONE},
+    /* HT40_STBC_BELOW  */ {CSI_RUNS_BELOW, CSI_RUNS_40_STBC,    CSI_RUNS_40_STBC},
+    /* HT40_STBC_ABOVE  */ {CSI_RUNS_ABOVE, CSI_RUNS_40_STBC,    CSI_RUNS_40_STBC},
+};
+
+/*
+ * Buffer length in bytes per mode with every field enabled, as listed in the same
+ * table. csi_layout_check.cpp asserts at build time that CSI_LAYOUT_RUNS adds up to it.
+ */
+static CSI_LAYOUT_TABLE uint16_t CSI_LAYOUT_GUIDE_LEN[CSI_MODE_COUNT] = {
+    128, 128, 128,  /* NONHT: none, below, above */
+    256, 256, 256,  /* HT20 */
+    384, 380, 376,  /* HT20 STBC */
+    384, 384,       /* HT40 */
+    612, 612,       /* HT40 STBC */
+};
+
+/* Indexed by [ht][cwb][stbc][secondary_channel]; non-HT packets ignore cwb and stbc. */
+static CSI_LAYOUT_TABLE uint8_t CSI_LAYOUT_MODES[2][2][2][3] = {
+    {
+        {{CSI_MODE_NONHT_NONE, CSI_MODE_NONHT_ABOVE, CSI_MODE_NONHT_BELOW},
+         {CSI_MODE_NONHT_NONE, CSI_MODE_NONHT_ABOVE, CSI_MODE_NONHT_BELOW}},
+        {{CSI_MODE_NONHT_NONE, CSI_MODE_NONHT_ABOVE, CSI_MODE_NONHT_BELOW},
+         {CSI_MODE_NONHT_NONE, CSI_MODE_NONHT_ABOVE, CSI_MODE_NONHT_BELOW}},
+    },
+    {
+        {{CSI_MODE_HT20_NONE, CSI_MODE_HT20_ABOVE, CSI_MODE_HT20_BELOW},
+         {CSI_MODE_HT20_STBC_NONE, CSI_MODE_HT20_STBC_ABOVE, CSI_MODE_HT20_STBC_BELOW}},
+        {{CSI_MODE_INVALID, CSI_MODE_HT40_ABOVE, CSI_MODE_HT40_BELOW},
+         {CSI_MODE_INVALID, CSI_MODE_HT40_STBC_ABOVE, CSI_MODE_HT40_STBC_BELOW}},
+    },
+};
+
+/* Byte offset and length of every field for one mode under one csi_config. */
+typedef struct {
+    uint8_t mode;
+    uint16_t offset[CSI_FIELD_COUNT];
+    uint16_t length[CSI_FIELD_COUNT];
+    uint16_t total;
+} csi_layout_t;
+
+static inline unsigned csi_layout_flags(bool lltf_en, bool htltf_en, bool stbc_htltf2_en)
+{
+    return (lltf_en ? CSI_LAYOUT_LLTF : 0) | (htltf_en ? CSI_LAYOUT_HTLTF : 0)
+         | (stbc_htltf2_en ? CSI_LAYOUT_STBC_HTLTF : 0);
+}
+
+/*
+ * sig_mode, cwb, stbc and secondary_channel as found in wifi_pkt_rx_ctrl_t
+ * (secondary_channel: 0 none, 1 above, 2 below). Returns CSI_MODE_INVALID for
+ * combinations the radio does not report.
+ */
+static inline csi_mode_t csi_layout_mode(unsigned sig_mode, unsigned cwb, unsigned stbc, unsigned secondary_channel)
+{
+    if (sig_mode > 1 || secondary_channel > 2) {
+        return CSI_MODE_INVALID;
+    }
+    return (csi_mode_t)CSI_LAYOUT_MODES[sig_mode][cwb & 1][stbc ? 1 : 0][secondary_channel];
+}
+
+#define CSI_LAYOUT_MODE_FROM_RX_CTRL(rx_ctrl) \
+    csi_layout_mode((rx_ctrl)->sig_mode, (rx_ctrl)->cwb, (rx_ctrl)->stbc, (rx_ctrl)->secondary_channel)
+
+static inline unsigned csi_layout_field_subcarriers(csi_mode_t mode, csi_field_t field)
+{
+    const csi_run_t *runs = CSI_LAYOUT_RUNS[mode][field];
+    return runs[0].count + runs[1].count;
+}
+
+static inline void csi_layout_init(csi_layout_t *layout, csi_mode_t mode, unsigned flags)
+{
+    layout->mode = mode;
+    layout->total = 0;
+    for (int field = 0; field < CSI_FIELD_COUNT; field++) {
+        unsigned length = 0;
+        if (mode < CSI_MODE_COUNT && (flags & (1u << field))) {
+            length = 2 * csi_layout_field_subcarriers(mode, (csi_field_t)field);
+        }
+        layout->offset[field] = layout->total;
+        layout->length[field] = length;
+        layout->total += length;
+    }
+}
+
+/* One layout per mode, so per-packet dispatch is a table lookup. */
+static inline void csi_layout_table_init(csi_layout_t table[CSI_MODE_COUNT], unsigned flags)
+{
+    for (int mode = 0; mode < CSI_MODE_COUNT; mode++) {
+        csi_layout_init(&table[mode], (csi_mode_t)mode, flags);
+    }
+}
+
+/* A buffer is only decodable with a layout if its length matches exactly. */
+static inline bool csi_layout_check(const csi_layout_t *layout, unsigned len)
+{
+    return layout->mode < CSI_MODE_COUNT && layout->total > 0 && layout->total == len;
+}
+
+/* Straight-line kernels over one run; no per-element branches, so they auto-vectorize. */
+static inline void csi_run_amplitude(const int8_t *CSI_LAYOUT_RESTRICT src, float *CSI_LAYOUT_RESTRICT dst, unsigned count)
+{
+    for (unsigned k = 0; k < count; k++) {
+        float imag = src[2 * k];
+        float real = src[2 * k + 1];
+        dst[k] = sqrtf(real * real + imag * imag);
+    }
+}
+
+static inline void csi_run_phase(const int8_t *CSI_LAYOUT_RESTRICT src, float *CSI_LAYOUT_RESTRICT dst, unsigned count)
+{
+    for (unsigned k = 0; k < count; k++) {
+        dst[k] = atan2f(src[2 * k], src[2 * k + 1]);
+    }
+}
+
+typedef void (*csi_run_kernel_t)(const int8_t *, float *, unsigned);
+
+/*
+ * Applies a kernel to one field and writes the result ordered by subcarrier
+ * index, lowest first. Returns the number of values written, 0 if the field is
+ * absent.
+ */
+static inline unsigned csi_layout_extract(const csi_layout_t *layout, csi_field_t field, const int8_t *buf,
+                                          float *out, csi_run_kernel_t kernel)
+{
+    if (layout->length[field] == 0) {
+        return 0;
+    }
+
+    const csi_run_t *runs = CSI_LAYOUT_RUNS[layout->mode][field];
+    int lowest = runs[1].count && runs[1].first < runs[0].first ? runs[1].first : runs[0].first;
+    const int8_t *src = buf + layout->offset[field];
+
+    for (int r = 0; r < CSI_LAYOUT_MAX_RUNS; r++) {
+        kernel(src, out + (runs[r].first - lowest), runs[r].count);
+        src += 2 * runs[r].count;
+    }
+    return layout->length[field] / 2;
+}
+
+static inline unsigned csi_layout_amplitude(const csi_layout_t *layout, csi_field_t field, const int8_t *buf, float *out)
+{
+    return csi_layout_extract(layout, field, buf, out, csi_run_amplitude);
+}
+
+static inline unsigned csi_layout_phase(const csi_layout_t *layout, csi_field_t field, const int8_t *buf, float *out)
+{
+    return csi_layout_extract(layout, field, buf, out, csi_run_phase);
+}
+
+/*
+ * Selection the models were trained on (CSI_VALID_SUBCARRIER_INDEX in the Python
+ * code): buffer positions 6..31 and 33..58 of the HT40 HT-LTF-only buffer, with
+ * real = buf[2i] and imag = buf[2i - 1]. That pairing straddles two documented
+ * subcarriers, but existing checkpoints depend on it, so it is kept as is.
+ */
+#define CSI_LEGACY_NUM_SUBCARRIERS  52
+#define CSI_LEGACY_BUFFER_LEN       256
+
+static inline void csi_layout_legacy_amplitude(const int8_t *CSI_LAYOUT_RESTRICT buf, float *CSI_LAYOUT_RESTRICT out)
+{
+    for (int i = 6; i < 32; i++) {
+        float real = buf[2 * i], imag = buf[2 * i - 1];
+        *out++ = sqrtf(real * real + imag * imag);
+    }
+    for (int i = 33; i < 59; i++) {
+        float real = buf[2 * i], imag = buf[2 * i - 1];
+        *out++ = sqrtf(real * real + imag * imag);
+    }
+}
+
+#ifdef __cplusplus
+}
+
+namespace csi_layout {
+
+constexpr unsigned field_length(csi_mode_t mode, unsigned flags, int field)
+{
+    return (flags & (1u << field)) ? 2u * (CSI_LAYOUT_RUNS[mode][field][0].count + CSI_LAYOUT_RUNS[mode][field][1].count) : 0u;
+}
+
+constexpr unsigned field_offset(csi_mode_t mode, unsigned flags, int field)
+{
+    return field == 0 ? 0u : field_offset(mode, flags, field - 1) + field_length(mode, flags, field - 1);
+}
+
+/* A mode fixed at compile time: offsets, lengths and run bounds fold into the kernels. */
+template <csi_mode_t Mode, unsigned Flags>
+struct Layout {
+    static_assert(Mode < CSI_MODE_COUNT, "invalid CSI mode");
+
+    static constexpr csi_mode_t mode = Mode;
+    static constexpr unsigned total = field_offset(Mode, Flags, CSI_FIELD_COUNT);
+
+    template <csi_field_t Field>
+    static constexpr unsigned subcarriers()
+    {
+        return field_length(Mode, Flags, Field) / 2;
+    }
+
+    template <csi_field_t Field, void (*Kernel)(const int8_t *, float *, unsigned)>
+    static unsigned extract(const int8_t *buf, float *out)
+    {
+        constexpr csi_run_t a = CSI_LAYOUT_RUNS[Mode][Field][0];
+        constexpr csi_run_t b = CSI_LAYOUT_RUNS[Mode][Field][1];
+        constexpr int lowest = b.count && b.first < a.first ? b.first : a.first;
+        constexpr unsigned offset = field_offset(Mode, Flags, Field);
+
+        if (subcarriers<Field>() == 0) {
+            return 0;
+        }
+        Kernel(buf + offset, out + (a.first - lowest), a.count);
+        if (b.count) {
+            Kernel(buf + offset + 2 * a.count, out + (b.first - lowest), b.count);
+        }
+        return subcarriers<Field>();
+    }
+
+    template <csi_field_t Field>
+    static unsigned amplitude(const int8_t *buf, float *out)
+    {
+        return extract<Field, csi_run_amplitude>(buf, out);
+    }
+
+    template <csi_field_t Field>
+    static unsigned phase(const int8_t *buf, float *out)
+    {
+        return extract<Field, csi_run_phase>(buf, out);
+    }
+};
+
+/* Index of the first mode whose runs disagree with CSI_LAYOUT_GUIDE_LEN, or CSI_MODE_COUNT. */
+constexpr int first_mismatch(int mode = 0)
+{
+    return mode == CSI_MODE_COUNT ? mode
+         : field_offset((csi_mode_t)mode, CSI_LAYOUT_LLTF | CSI_LAYOUT_HTLTF | CSI_LAYOUT_STBC_HTLTF, CSI_FIELD_COUNT)
+               != CSI_LAYOUT_GUIDE_LEN[mode] ? mode
+         : first_mismatch(mode + 1);
+}
+
+/*
+ * Runtime dispatch to the specialised layout: fn is called with a
+ * Layout<Mode, Flags> instance, e.g. a generic lambda. Returns false for
+ * CSI_MODE_INVALID.
+ */
+template <unsigned Flags, typename Fn>
+bool dispatch(csi_mode_t mode, Fn &&fn)
+{
+    switch (mode) {
+    case CSI_MODE_NONHT_NONE:      fn(Layout<CSI_MODE_NONHT_NONE, Flags>()); return true;
+    case CSI_MODE_NONHT_BELOW:     fn(Layout<CSI_MODE_NONHT_BELOW, Flags>()); return true;
+    case CSI_MODE_NONHT_ABOVE:     fn(Layout<CSI_MODE_NONHT_ABOVE, Flags>()); return true;
+    case CSI_MODE_HT20_NONE:       fn(Layout<CSI_MODE_HT20_NONE, Flags>()); return true;
+    case CSI_MODE_HT20_BELOW:      fn(Layout<CSI_MODE_HT20_BELOW, Flags>()); return true;
+    case CSI_MODE_HT20_ABOVE:      fn(Layout<CSI_MODE_HT20_ABOVE, Flags>()); return true;
+    case CSI_MODE_HT20_STBC_NONE:  fn(Layout<CSI_MODE_HT20_STBC_NONE, Flags>()); return true;
+    case CSI_MODE_HT20_STBC_BELOW: fn(Layout<CSI_MODE_HT20_STBC_BELOW, Flags>()); return true;
+    case CSI_MODE_HT20_STBC_ABOVE: fn(Layout<CSI_MODE_HT20_STBC_ABOVE, Flags>()); return true;
+    case CSI_MODE_HT40_BELOW:      fn(Layout<CSI_MODE_HT40_BELOW, Flags>()); return true;
+    case CSI_MODE_HT40_ABOVE:      fn(Layout<CSI_MODE_HT40_ABOVE, Flags>()); return true;
+    case CSI_MODE_HT40_STBC_BELOW: fn(Layout<CSI_MODE_HT40_STBC_BELOW, Flags>()); return true;
+    case CSI_MODE_HT40_STBC_ABOVE: fn(Layout<CSI_MODE_HT40_STBC_ABOVE, Flags>()); return true;
+    default:                       return false;
+    }
+}
+
+}  // namespace csi_layout
+#endif
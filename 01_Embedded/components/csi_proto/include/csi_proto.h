@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Payload of the ESP-NOW sounding frames sent by the TX nodes. It is shared by
+ * the TX and RX firmware so both sides agree on the schedule and on who sent a
+ * frame.
+ *
+ * TX nodes share one frame of 1 / rate_hz seconds, split into node_count equal
+ * slots. Node 0 is the master: its frame starts the slot schedule and doubles
+ * as the beacon the other nodes align to.
+ *
+ * seq counts every frame a node sends and tx_time_us is its esp_timer clock at
+ * send time, so receivers can tell which packet a CSI sample came from, count
+ * packets lost on the air and line up samples from several RX boards.
+ */
+
+#define CSI_PROTO_MAGIC         0xC5
+#define CSI_PROTO_CONTROL_MAGIC 0xC6
+#define CSI_PROTO_VERSION       1
+#define CSI_PROTO_MASTER_ID     0
+#define CSI_PROTO_MAX_NODES     8
+
+typedef struct __attribute__((packed)) {
+    uint8_t  magic;
+    uint8_t  version;
+    uint8_t  node_id;
+    uint8_t  node_count;
+    uint16_t rate_hz;
+    uint32_t frame;
+    uint32_t seq;
+    uint32_t tx_time_us;
+} csi_proto_sounding_t;
+
+/*
+ * Processing headroom reported by the servers, relayed by the gateway and the
+ * RX. 0 means the server is saturated, 1000 that it is idle.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  magic;
+    uint8_t  version;
+    uint16_t headroom;
+} csi_proto_control_t;
+
+#define CSI_PROTO_HEADROOM_MAX  1000
+
+static inline bool csi_proto_is_sounding(const uint8_t *data, int len)
+{
+    const csi_proto_sounding_t *frame = (const csi_proto_sounding_t *)data;
+    return len >= (int)sizeof(csi_proto_sounding_t)
+        && frame->magic == CSI_PROTO_MAGIC
+        && frame->version == CSI_PROTO_VERSION
+        && frame->node_id < CSI_PROTO_MAX_NODES;
+}
+
+static inline bool csi_proto_is_control(const uint8_t *data, int len)
+{
+    const csi_proto_control_t *frame = (const csi_proto_control_t *)data;
+    return len >= (int)sizeof(csi_proto_control_t)
+        && frame->magic == CSI_PROTO_CONTROL_MAGIC
+        && frame->version == CSI_PROTO_VERSION
+        && frame->headroom <= CSI_PROTO_HEADROOM_MAX;
+}
+
+static inline uint32_t csi_proto_frame_us(uint16_t rate_hz)
+{
+    return 1000000UL / (rate_hz ? rate_hz : 1);
+}
+
+static inline uint32_t csi_proto_slot_us(uint16_t rate_hz, uint8_t node_count)
+{
+    return csi_proto_frame_us(rate_hz) / (node_count ? node_count : 1);
+}
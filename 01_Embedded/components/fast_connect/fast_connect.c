@@ -0,0 +1,364 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include "fast_connect.h"
+
+#define TAG                     "FAST-CONNECT"
+
+#define CACHE_NAMESPACE         "fast_conn"
+#define APPLY_DELAY_MS          300
+#define DEFAULT_NETMASK         "255.255.255.0"
+
+/*
+ * The console task hands new settings to fast_connect_apply(), the apply timer
+ * takes them over and the event loop task reads them, so all state below is
+ * only touched with s_lock held.
+ */
+static SemaphoreHandle_t s_lock = NULL;
+static fast_connect_config_t s_config;
+static fast_connect_config_t s_pending;
+static esp_netif_t *s_netif = NULL;
+static esp_timer_handle_t s_retry_timer = NULL;
+static esp_timer_handle_t s_apply_timer = NULL;
+
+/* BSSID and channel of the last association with s_config.ssid. */
+static bool s_cached = false;
+static uint8_t s_bssid[6];
+static uint8_t s_channel = 0;
+
+static int s_failures = 0;
+/* Set while our own disconnect for a reconfiguration is on its way, so it is not counted as a failure. */
+static bool s_reconfiguring = false;
+static volatile bool s_up = false;
+static int64_t s_down_us = 0;
+
+static void cache_load(void)
+{
+    nvs_handle_t handle;
+    s_cached = false;
+    if (nvs_open(CACHE_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+
+    char ssid[sizeof(s_config.ssid)] = "";
+    size_t size = sizeof(ssid);
+    size_t bssid_size = sizeof(s_bssid);
+    if (nvs_get_str(handle, "ssid", ssid, &size) == ESP_OK &&
+        strcmp(ssid, s_config.ssid) == 0 &&
+        nvs_get_blob(handle, "bssid", s_bssid, &bssid_size) == ESP_OK && bssid_size == sizeof(s_bssid) &&
+        nvs_get_u8(handle, "channel", &s_channel) == ESP_OK && s_channel != 0) {
+        s_cached = true;
+    }
+    nvs_close(handle);
+}
+
+static void cache_save(const uint8_t *bssid, uint8_t channel)
+{
+    if (s_cached && s_channel == channel && memcmp(s_bssid, bssid, sizeof(s_bssid)) == 0) {
+        return;
+    }
+
+    nvs_handle_t handle;
+    if (nvs_open(CACHE_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+        nvs_set_str(handle, "ssid", s_config.ssid);
+        nvs_set_blob(handle, "bssid", bssid, sizeof(s_bssid));
+        nvs_set_u8(handle, "channel", channel);
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+    memcpy(s_bssid, bssid, sizeof(s_bssid));
+    s_channel = channel;
+    s_cached = true;
+    ESP_LOGI(TAG, "Cached AP " MACSTR " on channel %d", MAC2STR(bssid), channel);
+}
+
+static void cache_clear(void)
+{
+    nvs_handle_t handle;
+    if (nvs_open(CACHE_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+        nvs_erase_all(handle);
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+    s_cached = false;
+}
+
+static void apply_wifi_config(void)
+{
+    wifi_config_t wifi_config = {
+        .sta = {
+            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
+            .scan_method = WIFI_FAST_SCAN,
+            .sort_method = WIFI_CONNECT_AP_BY_SIGNAL,
+            .pmf_cfg = {
+                .capable = true,
+                .required = false
+            },
+        },
+    };
+    strncpy((char*)wifi_config.sta.ssid, s_config.ssid, sizeof(wifi_config.sta.ssid));
+    strncpy((char*)wifi_config.sta.password, s_config.password, sizeof(wifi_config.sta.password));
+
+    if (s_cached) {
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, s_bssid, sizeof(s_bssid));
+        wifi_config.sta.channel = s_channel;
+    }
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+}
+
+static void apply_ip_config(void)
+{
+    if (s_config.static_ip[0] == '\0') {
+        esp_netif_dhcpc_start(s_netif);
+        return;
+    }
+
+    esp_netif_ip_info_t ip_info = {0};
+    ip_info.ip.addr = esp_ip4addr_aton(s_config.static_ip);
+    ip_info.gw.addr = s_config.static_gw[0] ? esp_ip4addr_aton(s_config.static_gw) : 0;
+    ip_info.netmask.addr = esp_ip4addr_aton(s_config.static_mask[0] ? s_config.static_mask : DEFAULT_NETMASK);
+
+    esp_netif_dhcpc_stop(s_netif);
+    if (esp_netif_set_ip_info(s_netif, &ip_info) != ESP_OK) {
+        ESP_LOGE(TAG, "Invalid static IP %s", s_config.static_ip);
+    }
+}
+
+static void set_link(bool up)
+{
+    if (s_up == up) {
+        return;
+    }
+    s_up = up;
+    if (up) {
+        ESP_LOGI(TAG, "Link up after %lld ms", (long long)(esp_timer_get_time() - s_down_us) / 1000);
+    } else {
+        s_down_us = esp_timer_get_time();
+    }
+    if (s_config.on_link) {
+        s_config.on_link(up);
+    }
+}
+
+static void retry_timer_cb(void *arg)
+{
+    esp_wifi_connect();
+}
+
+static void apply_timer_cb(void *arg)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (strcmp(s_pending.ssid, s_config.ssid) != 0) {
+        cache_clear();
+    }
+    s_config = s_pending;
+    s_failures = 0;
+    s_reconfiguring = true;
+    apply_wifi_config();
+    apply_ip_config();
+    xSemaphoreGive(s_lock);
+
+    esp_timer_stop(s_retry_timer);
+    esp_wifi_disconnect();
+    esp_wifi_connect();
+}
+
+static void event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+        esp_wifi_connect();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+        s_failures = 0;
+        s_reconfiguring = false;
+        cache_save(event->bssid, event->channel);
+        if (s_config.static_ip[0] != '\0') {
+            set_link(true);
+        }
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
+        set_link(false);
+        if (s_reconfiguring && event->reason == WIFI_REASON_ASSOC_LEAVE) {
+            /* apply_timer_cb already reconnects with the new settings. */
+            s_reconfiguring = false;
+            xSemaphoreGive(s_lock);
+            return;
+        }
+        s_failures++;
+
+        if (s_cached && s_failures >= FAST_CONNECT_CACHE_FAILURES) {
+            ESP_LOGW(TAG, "Cached AP unreachable (reason %d), scanning", event->reason);
+            cache_clear();
+            apply_wifi_config();
+        }
+
+        /* The first retry is immediate: most drops are a single missed beacon. */
+        int shift = s_failures < 2 ? -1 : s_failures - 2 > 6 ? 6 : s_failures - 2;
+        int delay_ms = shift < 0 ? 0 : FAST_CONNECT_BACKOFF_MIN_MS << shift;
+        if (delay_ms > FAST_CONNECT_BACKOFF_MAX_MS) {
+            delay_ms = FAST_CONNECT_BACKOFF_MAX_MS;
+        }
+        if (delay_ms == 0) {
+            esp_wifi_connect();
+        } else {
+            ESP_LOGI(TAG, "Reconnect %d in %d ms (reason %d)", s_failures, delay_ms, event->reason);
+            esp_timer_stop(s_retry_timer);
+            esp_timer_start_once(s_retry_timer, (uint64_t)delay_ms * 1000);
+        }
+    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+        ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+        set_link(true);
+    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_LOST_IP) {
+        set_link(false);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+esp_err_t fast_connect_init(const fast_connect_config_t *config)
+{
+    s_lock = xSemaphoreCreateMutex();
+    if (s_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    s_config = *config;
+    s_down_us = esp_timer_get_time();
+
+    s_netif = esp_netif_create_default_wifi_sta();
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    /* The AP is cached here; Wi-Fi's own NVS copy would only cost flash writes. */
+    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID,
+                                                        &event_handler, NULL, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, ESP_EVENT_ANY_ID,
+                                                        &event_handler, NULL, NULL));
+
+    const esp_timer_create_args_t retry_args = { .callback = retry_timer_cb, .name = "wifi_retry" };
+    const esp_timer_create_args_t apply_args = { .callback = apply_timer_cb, .name = "wifi_apply" };
+    ESP_ERROR_CHECK(esp_timer_create(&retry_args, &s_retry_timer));
+    ESP_ERROR_CHECK(esp_timer_create(&apply_args, &s_apply_timer));
+
+    cache_load();
+
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    apply_wifi_config();
+    apply_ip_config();
+    ESP_ERROR_CHECK(esp_wifi_start());
+
+    if (s_cached) {
+        ESP_LOGI(TAG, "Connecting to %s via cached AP " MACSTR " on channel %d%s", s_config.ssid,
+                 MAC2STR(s_bssid), s_channel, s_config.static_ip[0] ? ", static IP" : "");
+    } else {
+        ESP_LOGI(TAG, "Connecting to %s%s", s_config.ssid, s_config.static_ip[0] ? ", static IP" : "");
+    }
+    return ESP_OK;
+}
+
+esp_err_t fast_connect_apply(const fast_connect_config_t *config)
+{
+    if (s_netif == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_pending = *config;
+    s_pending.on_link = s_config.on_link;
+    xSemaphoreGive(s_lock);
+
+    esp_timer_stop(s_apply_timer);
+    return esp_timer_start_once(s_apply_timer, APPLY_DELAY_MS * 1000);
+}
+
+bool fast_connect_is_up(void)
+{
+    return s_up;
+}
+
+void fast_connect_load_config(nvs_handle_t handle, fast_connect_config_t *config)
+{
+    size_t size = sizeof(config->ssid);
+    nvs_get_str(handle, "wifi_ssid", config->ssid, &size);
+    size = sizeof(config->password);
+    nvs_get_str(handle, "wifi_pwd", config->password, &size);
+    size = sizeof(config->static_ip);
+    nvs_get_str(handle, "static_ip", config->static_ip, &size);
+    size = sizeof(config->static_gw);
+    nvs_get_str(handle, "static_gw", config->static_gw, &size);
+    size = sizeof(config->static_mask);
+    nvs_get_str(handle, "static_mask", config->static_mask, &size);
+}
+
+void fast_connect_save_config(nvs_handle_t handle, const fast_connect_config_t *config)
+{
+    nvs_set_str(handle, "wifi_ssid", config->ssid);
+    nvs_set_str(handle, "wifi_pwd", config->password);
+    nvs_set_str(handle, "static_ip", config->static_ip);
+    nvs_set_str(handle, "static_gw", config->static_gw);
+    nvs_set_str(handle, "static_mask", config->static_mask);
+}
+
+static bool parse_address(const char *text, esp_ip4_addr_t *addr)
+{
+    return strlen(text) < sizeof(((fast_connect_config_t *)0)->static_ip) &&
+           esp_netif_str_to_ip4(text, addr) == ESP_OK;
+}
+
+esp_err_t fast_connect_parse_static(const char *arg, fast_connect_config_t *config)
+{
+    if (strcmp(arg, "DHCP") == 0) {
+        config->static_ip[0] = '\0';
+        config->static_gw[0] = '\0';
+        config->static_mask[0] = '\0';
+        return ESP_OK;
+    }
+
+    char buf[3 * sizeof(config->static_ip)];
+    if (strlen(arg) >= sizeof(buf)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    strcpy(buf, arg);
+
+    char *fields[3] = { buf, NULL, NULL };
+    for (int i = 1; i < 3; i++) {
+        char *comma = strchr(fields[i - 1], ',');
+        if (comma == NULL) {
+            break;
+        }
+        *comma = '\0';
+        fields[i] = comma + 1;
+    }
+
+    esp_ip4_addr_t ip, gw, mask;
+    if (!parse_address(fields[0], &ip) || ip.addr == 0 ||
+        (fields[1] && fields[1][0] && !parse_address(fields[1], &gw)) ||
+        (fields[2] && (strchr(fields[2], ',') || !parse_address(fields[2], &mask)))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (fields[2]) {
+        /* A netmask is a run of ones followed by zeros. */
+        uint32_t inverse = ~esp_netif_htonl(mask.addr);
+        if (mask.addr == 0 || (inverse & (inverse + 1)) != 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    strcpy(config->static_ip, fields[0]);
+    strcpy(config->static_gw, fields[1] ? fields[1] : "");
+    strcpy(config->static_mask, fields[2] ? fields[2] : "");
+    return ESP_OK;
+}
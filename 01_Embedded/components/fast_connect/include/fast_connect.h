@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "nvs.h"
+
+/*
+ * Station bring-up shared by the gateway and the cameras, tuned for getting
+ * back on the AP quickly after a boot or a dropped link.
+ *
+ * The BSSID and channel of the last association are cached in NVS and pinned
+ * in the station config, so connecting needs no full scan; the cache is
+ * dropped after FAST_CONNECT_CACHE_FAILURES failed attempts and the next one
+ * scans. With a static IP, DHCP is skipped altogether. Otherwise enable
+ * CONFIG_LWIP_DHCP_RESTORE_LAST_IP so the lease is requested directly. Failed
+ * reconnects back off exponentially from an immediate first retry.
+ */
+
+#define FAST_CONNECT_CACHE_FAILURES 2
+#define FAST_CONNECT_BACKOFF_MIN_MS 100
+#define FAST_CONNECT_BACKOFF_MAX_MS 5000
+
+typedef struct {
+    char ssid[32];
+    char password[64];
+    /*
+     * Empty static_ip means DHCP. Without static_gw the station has no default
+     * route (only the local subnet is reachable); static_mask defaults to /24.
+     */
+    char static_ip[16];
+    char static_gw[16];
+    char static_mask[16];
+    /*
+     * Called from the event loop task when the link is up (has an IP) or down,
+     * with fast_connect's lock held: it must not call back into fast_connect.
+     */
+    void (*on_link)(bool up);
+} fast_connect_config_t;
+
+/* Creates the station netif, starts Wi-Fi and connects. Call once after esp_netif_init. */
+esp_err_t fast_connect_init(const fast_connect_config_t *config);
+
+/*
+ * Applies new credentials or IP settings without a reboot. Calls are coalesced
+ * for a short moment so that several console commands cause one reconnect.
+ */
+esp_err_t fast_connect_apply(const fast_connect_config_t *config);
+
+bool fast_connect_is_up(void);
+
+/*
+ * Reads and writes config in an open NVS handle, under the keys wifi_ssid,
+ * wifi_pwd, static_ip, static_gw and static_mask. Missing keys keep their value.
+ */
+void fast_connect_load_config(nvs_handle_t handle, fast_connect_config_t *config);
+void fast_connect_save_config(nvs_handle_t handle, const fast_connect_config_t *config);
+
+/*
+ * Parses the argument of SET_STATIC: "ip[,gateway[,netmask]]" or "DHCP". All
+ * addresses are validated first; on ESP_ERR_INVALID_ARG config is unchanged.
+ */
+esp_err_t fast_connect_parse_static(const char *arg, fast_connect_config_t *config);
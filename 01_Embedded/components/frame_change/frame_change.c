@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "img_converters.h"
+
+#include "frame_change.h"
+
+#define TAG                 "FRAME-CHANGE"
+
+#define SIGNATURE_W         16
+#define SIGNATURE_H         12
+#define SIGNATURE_LEN       (SIGNATURE_W * SIGNATURE_H)
+
+static uint8_t *s_rgb = NULL;
+static size_t s_rgb_len = 0;
+static uint8_t s_signature[SIGNATURE_LEN];
+static uint8_t s_sent_signature[SIGNATURE_LEN];
+static bool s_have_sent_signature = false;
+static uint32_t s_seq = 0;
+static uint32_t s_sent_seq = 0;
+static uint32_t s_skipped = 0;
+static TickType_t s_sent_tick = 0;
+static bool s_send_failed = false;
+
+/*
+ * Mean luminance of SIGNATURE_W x SIGNATURE_H blocks, taken from a 1/8 scale
+ * decode of the JPEG. Returns false if the frame could not be decoded.
+ */
+static bool frame_signature(const camera_fb_t *pic, uint8_t *rgb, size_t rgb_len, uint8_t *signature)
+{
+    int width = pic->width / 8;
+    int height = pic->height / 8;
+    if (width < SIGNATURE_W || height < SIGNATURE_H || (size_t)(width * height * 2) > rgb_len ||
+        !jpg2rgb565(pic->buf, pic->len, rgb, JPG_SCALE_8X)) {
+        return false;
+    }
+
+    uint32_t sum[SIGNATURE_LEN] = {0};
+    uint16_t count[SIGNATURE_LEN] = {0};
+    for (int y = 0; y < height; y++) {
+        const uint8_t *row = rgb + y * width * 2;
+        int block_row = (y * SIGNATURE_H / height) * SIGNATURE_W;
+        for (int x = 0; x < width; x++) {
+            uint16_t pixel = (row[2 * x] << 8) | row[2 * x + 1];
+            int r = (pixel >> 8) & 0xF8;
+            int g = (pixel >> 3) & 0xFC;
+            int b = (pixel << 3) & 0xF8;
+            int block = block_row + x * SIGNATURE_W / width;
+            sum[block] += (77 * r + 150 * g + 29 * b) >> 8;
+            count[block]++;
+        }
+    }
+    for (int i = 0; i < SIGNATURE_LEN; i++) {
+        signature[i] = sum[i] / count[i];
+    }
+    return true;
+}
+
+static int signature_distance(const uint8_t *a, const uint8_t *b)
+{
+    int distance = 0;
+    for (int i = 0; i < SIGNATURE_LEN; i++) {
+        int diff = abs(a[i] - b[i]);
+        if (diff > distance) {
+            distance = diff;
+        }
+    }
+    return distance;
+}
+
+/* Leaves the signature of pic in s_signature; *valid is false if it could not be taken. */
+static bool frame_changed(const camera_fb_t *pic, int threshold, bool *valid)
+{
+    *valid = false;
+    if (threshold <= 0) {
+        return true;
+    }
+    if (s_rgb == NULL) {
+        s_rgb_len = ((pic->width + 7) / 8) * ((pic->height + 7) / 8) * 2;
+        s_rgb = malloc(s_rgb_len);
+    }
+
+    *valid = s_rgb != NULL && frame_signature(pic, s_rgb, s_rgb_len, s_signature);
+    return !*valid || !s_have_sent_signature || s_send_failed ||
+           xTaskGetTickCount() - s_sent_tick >= pdMS_TO_TICKS(FRAME_CHANGE_KEYFRAME_MS) ||
+           signature_distance(s_signature, s_sent_signature) > threshold;
+}
+
+bool frame_change_send(int sock, const camera_fb_t *pic, const struct sockaddr_in *dest, int threshold)
+{
+    s_seq++;
+
+    bool valid;
+    if (!frame_changed(pic, threshold, &valid)) {
+        char marker[40];
+        int len = snprintf(marker, sizeof(marker), FRAME_CHANGE_SAME_PREFIX "%lu,%lu\n",
+                           (unsigned long)s_seq, (unsigned long)s_sent_seq);
+        sendto(sock, marker, len, 0, (const struct sockaddr *)dest, sizeof(*dest));
+        if (++s_skipped % 1000 == 0) {
+            ESP_LOGI(TAG, "%lu unchanged frames skipped", (unsigned long)s_skipped);
+        }
+        return false;
+    }
+
+    /* lwIP copies both parts into one pbuf either way; the iovec only keeps the trailer out of the frame buffer. */
+    uint8_t trailer[8];
+    memcpy(trailer, FRAME_CHANGE_TRAILER_MAGIC, 4);
+    memcpy(trailer + 4, &s_seq, sizeof(s_seq));
+    struct iovec iov[2] = {
+        { .iov_base = pic->buf, .iov_len = pic->len },
+        { .iov_base = trailer, .iov_len = sizeof(trailer) },
+    };
+    struct msghdr msg = {
+        .msg_name = (void *)dest,
+        .msg_namelen = sizeof(*dest),
+        .msg_iov = iov,
+        .msg_iovlen = 2,
+    };
+    /* Markers may only refer to a frame that left the socket; a failed send (often ENOMEM) goes out in full next time. */
+    s_send_failed = sendmsg(sock, &msg, 0) < 0;
+    if (s_send_failed) {
+        return false;
+    }
+    s_sent_seq = s_seq;
+    s_sent_tick = xTaskGetTickCount();
+    memcpy(s_sent_signature, s_signature, sizeof(s_signature));
+    s_have_sent_signature = valid;
+    return true;
+}
+
+int frame_change_parse_threshold(const char *arg)
+{
+    int threshold = atoi(arg);
+    return threshold < 0 ? 0 : threshold > FRAME_CHANGE_MAX_THRESHOLD ? FRAME_CHANGE_MAX_THRESHOLD : threshold;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include "esp_camera.h"
+#include "lwip/sockets.h"
+
+/*
+ * Change detection for the camera uplink, shared by both camera boards.
+ *
+ * Frames whose luminance signature differs from the last sent frame by at most
+ * the change threshold in every block are not sent; a "SAME:<seq>,<ref>" marker
+ * goes out instead so the server can repeat frame <ref> and stay aligned with
+ * CSI. Sent frames carry FRAME_CHANGE_TRAILER_MAGIC and their sequence number
+ * after the JPEG. A frame is always sent after FRAME_CHANGE_KEYFRAME_MS, or if
+ * it cannot be decoded. A threshold of 0 sends every frame.
+ */
+
+#define FRAME_CHANGE_DEFAULT_THRESHOLD  10
+#define FRAME_CHANGE_MAX_THRESHOLD      255
+#define FRAME_CHANGE_KEYFRAME_MS        1000
+#define FRAME_CHANGE_TRAILER_MAGIC      "CSIF"
+#define FRAME_CHANGE_SAME_PREFIX        "SAME:"
+
+/*
+ * Sends one captured frame to dest on sock, in full or as a marker. Call it for
+ * every frame from a single task. Returns true if the frame was sent in full;
+ * false for a marker or a failed send.
+ */
+bool frame_change_send(int sock, const camera_fb_t *pic, const struct sockaddr_in *dest, int threshold);
+
+/* Threshold from the argument of SET_CHANGE:n, clamped to 0..FRAME_CHANGE_MAX_THRESHOLD. */
+int frame_change_parse_threshold(const char *arg);
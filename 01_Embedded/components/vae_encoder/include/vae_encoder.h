@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Int8 fixed-point port of the streaming VAE encoder (models/vae.py), producing
+ * the latent mean the server decoder consumes.
+ *
+ * The subcarrier encoder runs once per frame as it is pushed, so a window only
+ * stores 8 int8 features per frame; the latent MLP runs over the whole window
+ * when a latent is requested. Weights, per-channel requantization factors and
+ * activation scales come from vae_encoder_weights.h.
+ */
+
+#define VAE_ENC_SUBCARRIERS 52
+#define VAE_ENC_HIDDEN      256
+#define VAE_ENC_FEATURES    8
+#define VAE_ENC_WINDOW      151
+#define VAE_ENC_LATENT      128
+
+typedef struct {
+    int8_t features[VAE_ENC_WINDOW][VAE_ENC_FEATURES];
+    uint16_t head;
+    uint16_t count;
+} vae_encoder_window_t;
+
+void vae_encoder_window_reset(vae_encoder_window_t *window);
+
+/* Encodes one frame of legacy subcarrier amplitudes and appends it to the window. */
+void vae_encoder_push(vae_encoder_window_t *window, const float amplitude[VAE_ENC_SUBCARRIERS]);
+
+static inline bool vae_encoder_ready(const vae_encoder_window_t *window)
+{
+    return window->count >= VAE_ENC_WINDOW;
+}
+
+/* Latent mean of the current window, quantized; multiply by vae_encoder_latent_scale() to recover it. */
+void vae_encoder_latent(const vae_encoder_window_t *window, int8_t mu[VAE_ENC_LATENT]);
+
+float vae_encoder_latent_scale(void);
+
+size_t vae_encoder_window_size(void);
@@ -0,0 +1,121 @@
+#include <string.h>
+#include <math.h>
+
+#include "vae_encoder.h"
+#include "vae_encoder_weights.h"
+
+/*
+ * One int8 dense layer: int32 accumulation, then per-output-channel
+ * requantization by mult * 2^-(31 + shift). LeakyReLU is folded into a second
+ * set of factors used for negative accumulators.
+ */
+typedef struct {
+    const int8_t *weight;
+    const int32_t *bias;
+    const int32_t *mult;
+    const int8_t *shift;
+    const int32_t *mult_neg;
+    const int8_t *shift_neg;
+    int n_in;
+    int n_out;
+} dense_t;
+
+static inline int8_t requantize(int32_t acc, int32_t mult, int shift)
+{
+    int total = 31 + shift;
+    int64_t value = ((int64_t)acc * mult + ((int64_t)1 << (total - 1))) >> total;
+    return value > 127 ? 127 : value < -127 ? -127 : (int8_t)value;
+}
+
+static inline int32_t dot(const int8_t *a, const int8_t *b, int n)
+{
+    int32_t acc = 0;
+    for (int i = 0; i < n; i++) {
+        acc += (int32_t)a[i] * b[i];
+    }
+    return acc;
+}
+
+/* The input may be split in two parts, so a ring-buffered window needs no copy. */
+static void dense_forward(const dense_t *layer, const int8_t *x0, int n0, const int8_t *x1, int8_t *y)
+{
+    for (int o = 0; o < layer->n_out; o++) {
+        const int8_t *w = layer->weight + (size_t)o * layer->n_in;
+        int32_t acc = layer->bias[o] + dot(w, x0, n0);
+        if (n0 < layer->n_in) {
+            acc += dot(w + n0, x1, layer->n_in - n0);
+        }
+
+        if (acc < 0 && layer->mult_neg) {
+            y[o] = requantize(acc, layer->mult_neg[o], layer->shift_neg[o]);
+        } else {
+            y[o] = requantize(acc, layer->mult[o], layer->shift[o]);
+        }
+    }
+}
+
+#define DENSE_LEAKY(n, in, out) { \
+    VAE_ENC_W##n, VAE_ENC_B##n, VAE_ENC_M##n, VAE_ENC_S##n, VAE_ENC_MN##n, VAE_ENC_SN##n, (in), (out) }
+#define DENSE_LINEAR(n, in, out) { \
+    VAE_ENC_W##n, VAE_ENC_B##n, VAE_ENC_M##n, VAE_ENC_S##n, NULL, NULL, (in), (out) }
+
+static const dense_t s_subcarrier[2] = {
+    DENSE_LEAKY(0, VAE_ENC_SUBCARRIERS, VAE_ENC_HIDDEN),
+    DENSE_LINEAR(1, VAE_ENC_HIDDEN, VAE_ENC_FEATURES),
+};
+
+static const dense_t s_latent[4] = {
+    DENSE_LEAKY(2, VAE_ENC_FEATURES * VAE_ENC_WINDOW, VAE_ENC_HIDDEN),
+    DENSE_LEAKY(3, VAE_ENC_HIDDEN, VAE_ENC_HIDDEN),
+    DENSE_LEAKY(4, VAE_ENC_HIDDEN, VAE_ENC_HIDDEN),
+    DENSE_LINEAR(5, VAE_ENC_HIDDEN, VAE_ENC_LATENT),
+};
+
+void vae_encoder_window_reset(vae_encoder_window_t *window)
+{
+    memset(window, 0, sizeof(*window));
+}
+
+void vae_encoder_push(vae_encoder_window_t *window, const float amplitude[VAE_ENC_SUBCARRIERS])
+{
+    int8_t x[VAE_ENC_SUBCARRIERS];
+    int8_t hidden[VAE_ENC_HIDDEN];
+
+    for (int i = 0; i < VAE_ENC_SUBCARRIERS; i++) {
+        float q = roundf(amplitude[i] / VAE_ENC_INPUT_SCALE);
+        x[i] = q > 127.0f ? 127 : q < -127.0f ? -127 : (int8_t)q;
+    }
+
+    dense_forward(&s_subcarrier[0], x, VAE_ENC_SUBCARRIERS, NULL, hidden);
+    dense_forward(&s_subcarrier[1], hidden, VAE_ENC_HIDDEN, NULL, window->features[window->head]);
+
+    window->head = (window->head + 1) % VAE_ENC_WINDOW;
+    if (window->count < VAE_ENC_WINDOW) {
+        window->count++;
+    }
+}
+
+void vae_encoder_latent(const vae_encoder_window_t *window, int8_t mu[VAE_ENC_LATENT])
+{
+    int8_t a[VAE_ENC_HIDDEN];
+    int8_t b[VAE_ENC_HIDDEN];
+
+    /* Once full, head is the oldest frame: the window starts there and wraps. */
+    int oldest = window->count < VAE_ENC_WINDOW ? 0 : window->head;
+    int n0 = (VAE_ENC_WINDOW - oldest) * VAE_ENC_FEATURES;
+
+    dense_forward(&s_latent[0], window->features[oldest], n0, window->features[0], a);
+    dense_forward(&s_latent[1], a, VAE_ENC_HIDDEN, NULL, b);
+    dense_forward(&s_latent[2], b, VAE_ENC_HIDDEN, NULL, a);
+    dense_forward(&s_latent[3], a, VAE_ENC_HIDDEN, NULL, mu);
+}
+
+float vae_encoder_latent_scale(void)
+{
+    return VAE_ENC_LATENT_SCALE;
+}
+
+size_t vae_encoder_window_size(void)
+{
+    return sizeof(vae_encoder_window_t);
+}
@@ -3,13 +3,18 @@ import multiprocessing
 import asyncio
 import os
 import logging
+import socket
+import struct
+import sys
 from pathlib import Path
-from io import BytesIO
-from time import time
+from time import monotonic, time
 
 import numpy as np
 import cv2
-from PIL import Image
+
+sys.path.append(str(Path(__file__).resolve().parent.parent / 'common'))
+from ingest_metrics import IngestMetrics, csi_head, start_http_server
+from pack_store import PackWriter
 
 
 logging.basicConfig(
@@ -22,10 +27,22 @@ logger = logging.getLogger(__name__)
 UDP_HOST = '0.0.0.0'
 CSI_UDP_PORT = 8000
 IMAGE_UDP_PORT = 8001
+METRICS_HOST = '127.0.0.1'
+METRICS_PORT = 9100
 CSI_DATA_LENGTH = 256
+LATE_PREFIX = 'LATE,'
+# Camera frames end in magic + uint32 sequence number; unchanged frames are sent
+# as "SAME:<seq>,<ref>" and stored as a copy of frame <ref>.
+FRAME_TRAILER_MAGIC = b'CSIF'
+SAME_PREFIX = b'SAME:'
+HEADROOM_INTERVAL = 1.0
+PENDING_WRITE_LIMIT = 2000
+# Set to the group of a gateway multicast sink (ADD_SINK) to receive it as well.
+CSI_MULTICAST_GROUP = None
 
 csi_count = 0
 image_count = 0
+pending_writes = 0
 
 image_queue = multiprocessing.Queue(maxsize=10)
 
@@ -34,23 +51,79 @@ current_file_path = Path(__file__).resolve()
 current_folder = current_file_path.parent
 dirname = os.path.join(current_folder, 'media', str(int(time())))
 csi_path = os.path.join(dirname, 'csi.csv')
+late_csi_path = os.path.join(dirname, 'csi_late.csv')
 os.makedirs(dirname, exist_ok=True)
 
+CSI_COLUMNS = '"mac","tx_id","seq","tx_timestamp","rx_seq","rssi","rate","sig_mode","mcs","bandwidth","smoothing","not_sounding","aggregation","stbc","fec_coding","sgi","noise_floor","ampdu_cnt","channel","secondary_channel","local_timestamp","ant","sig_len","rx_state","len","first_word","data"\n'
+
 with open(csi_path, 'w') as f:
-    f.write('"type","id","mac","rssi","rate","sig_mode","mcs","bandwidth","smoothing","not_sounding","aggregation","stbc","fec_coding","sgi","noise_floor","ampdu_cnt","channel","secondary_channel","local_timestamp","ant","sig_len","rx_state","len","first_word","data"\n')
+    f.write('"type","id",' + CSI_COLUMNS)
+
+# Records replayed from the gateway spool after an uplink outage. They carry no
+# image alignment, so they are kept apart from csi.csv and keyed by their RX timestamp.
+with open(late_csi_path, 'w') as f:
+    f.write('"type","late_ms",' + CSI_COLUMNS)
 
 executor = concurrent.futures.ThreadPoolExecutor(max_workers=10)
+image_pack = PackWriter(dirname)
+
+metrics = IngestMetrics('csi_collection')
+writer_lag = metrics.summary('writer_lag_seconds', 'Time from receiving a datagram to its file write finishing.')
+
+
+def queue_depth(q):
+    try:
+        return q.qsize()
+    except NotImplementedError:
+        return -1
+
+
+def parse_error(reason):
+    metrics.count('parse_errors_total', 'Rejected CSI records by reason.', f'reason="{reason}"')
+
+
+metrics.gauge('pending_writes', 'File writes queued on the executor.', lambda: pending_writes)
+metrics.gauge('image_queue_depth', 'Frames waiting for the display process.', lambda: queue_depth(image_queue))
 
 
 async def stats_printer():
     global csi_count, image_count
     while True:
         await asyncio.sleep(1.0)
-        logger.info(f'CSI: {csi_count} Hz | Image: {image_count} Hz')
+        metrics.tick(1.0)
+        logger.info(f'CSI: {csi_count} Hz | Image: {image_count} Hz | sources: {len(metrics.sources)}, '
+                    f'pending writes: {pending_writes}')
         csi_count = 0
         image_count = 0
 
 
+def write_done(submitted):
+    global pending_writes
+    pending_writes -= 1
+    writer_lag.observe(monotonic() - submitted)
+
+
+def submit_write(func, *args):
+    """Queues a file write on the executor and tracks the backlog for headroom reports."""
+    global pending_writes
+    pending_writes += 1
+    submitted = monotonic()
+    future = asyncio.get_running_loop().run_in_executor(executor, func, *args)
+    future.add_done_callback(lambda _: write_done(submitted))
+    return future
+
+
+async def headroom_reporter(protocol):
+    """Tells every gateway heard from in the last interval how much write capacity is left."""
+    while True:
+        await asyncio.sleep(HEADROOM_INTERVAL)
+        headroom = max(0, int(1000 * (1 - pending_writes / PENDING_WRITE_LIMIT)))
+        message = f'HEADROOM:{headroom}\n'.encode()
+        for addr in protocol.gateways:
+            protocol.transport.sendto(message, addr)
+        protocol.gateways.clear()
+
+
 def is_valid_csi_count(decoded_data, expected_count):
     start_index = decoded_data.rfind('[')
     end_index = decoded_data.rfind(']')
@@ -63,21 +136,48 @@ def is_valid_csi_count(decoded_data, expected_count):
     return False
     
 
+def multicast_socket(group, port):
+    """UDP socket bound to port that has joined group, shareable with other servers on this host."""
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind((UDP_HOST, port))
+    membership = struct.pack('4s4s', socket.inet_aton(group), socket.inet_aton('0.0.0.0'))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+    return sock
+
+
 def save_csi_worker(data_id, decoded_data):
     with open(csi_path, 'a') as f:
         f.write(f'"CSI_DATA",{data_id},{decoded_data}')
 
 
-def save_image_worker(data_id, raw_data, queue):
+def save_late_csi_worker(late_ms, decoded_data):
+    with open(late_csi_path, 'a') as f:
+        f.write(f'"CSI_DATA",{late_ms},{decoded_data}')
+
+
+def split_late_prefix(decoded_data):
+    late_ms, _, record = decoded_data[len(LATE_PREFIX):].partition(',')
+    return int(late_ms), record
+
+
+def save_image_worker(data_id, timestamp, raw_data, queue, source=None, seq=None):
     try:
-        image = Image.open(BytesIO(raw_data))
-        image.save(os.path.join(dirname, f'{data_id}.png'))
+        if not raw_data.startswith(b'\xff\xd8'):
+            logger.error(f'Image save error: not a JPEG frame ({len(raw_data)} bytes)')
+            return
+        image_pack.append(data_id, timestamp, raw_data, source, seq)
         if not queue.full():
             queue.put_nowait(raw_data)
     except Exception as e:
         logger.error(f'Image save error: {e}')
 
 
+def repeat_image_worker(data_id, timestamp, source, seq):
+    if not image_pack.repeat(data_id, timestamp, source, seq):
+        logger.warning(f'Unchanged frame refers to frame {seq} from {source}, which was not stored')
+
+
 def display_worker(queue):
     while True:
         try:
@@ -97,20 +197,39 @@ def display_worker(queue):
 
 
 class CsiUdpServerProtocol:
+    def __init__(self):
+        self.transport = None
+        self.gateways = set()
+
     def connection_made(self, transport):
+        self.transport = transport
         logger.info(f'CSI server started on port {CSI_UDP_PORT}')
 
     def datagram_received(self, data, addr):
         global current_id, csi_count
         try:
             decoded_data = data.decode()
-            if is_valid_csi_count(decoded_data, CSI_DATA_LENGTH):
-                current_id += 1
-                csi_count += 1
-                asyncio.get_running_loop().run_in_executor(
-                    executor, save_csi_worker, current_id, decoded_data
-                )
+            if decoded_data.startswith(LATE_PREFIX):
+                late_ms, decoded_data = split_late_prefix(decoded_data)
+                if is_valid_csi_count(decoded_data, CSI_DATA_LENGTH):
+                    metrics.count('late_records_total', 'Spooled records replayed by the gateway.')
+                    submit_write(save_late_csi_worker, late_ms, decoded_data)
+                else:
+                    parse_error('length')
+                return
+
+            self.gateways.add(addr)
+            # Under load the gateway packs several records into one datagram.
+            for line in decoded_data.splitlines(keepends=True):
+                if is_valid_csi_count(line, CSI_DATA_LENGTH):
+                    current_id += 1
+                    csi_count += 1
+                    metrics.record(addr[0], *csi_head(line))
+                    submit_write(save_csi_worker, current_id, line)
+                else:
+                    parse_error('length')
         except Exception as e:
+            parse_error('decode')
             logger.error(f'CSI UDP error: {e}')
 
     def connection_lost(self, exc):
@@ -118,6 +237,9 @@ class CsiUdpServerProtocol:
 
 
 class ImageUdpServerProtocol:
+    def __init__(self):
+        self.last_write = {}
+
     def connection_made(self, transport):
         logger.info(f'Image server started on port {IMAGE_UDP_PORT}')
 
@@ -125,12 +247,33 @@ class ImageUdpServerProtocol:
         global image_count
         try:
             image_count += 1
-            asyncio.get_running_loop().run_in_executor(
-                executor, save_image_worker, current_id, data, image_queue
-            )
+            if data.startswith(SAME_PREFIX):
+                self.repeat_frame(data, addr)
+                return
+
+            seq = None
+            if data[-8:-4] == FRAME_TRAILER_MAGIC:
+                seq = int.from_bytes(data[-4:], 'little')
+                data = data[:-8]
+            metrics.count('images_received_total', 'Camera frames received.')
+            self.last_write[addr] = submit_write(save_image_worker, current_id, time(), data, image_queue, addr, seq)
         except Exception as e:
             logger.error(f'Image UDP error: {e}')
 
+    def repeat_frame(self, data, addr):
+        """Stores an unchanged frame as a copy of its reference once that one is written."""
+        seq = int(data[len(SAME_PREFIX):].split(b',')[1])
+        previous = self.last_write.get(addr)
+        if previous is None:
+            return
+
+        metrics.count('images_repeated_total', 'Unchanged camera frames stored as a copy of an earlier one.')
+        args = (repeat_image_worker, current_id, time(), addr, seq)
+        if previous.done():
+            submit_write(*args)
+        else:
+            previous.add_done_callback(lambda _: submit_write(*args))
+
     def connection_lost(self, exc):
         pass
 
@@ -141,10 +284,16 @@ async def main():
     display_proc = multiprocessing.Process(target=display_worker, args=(image_queue, ))
     display_proc.start()
 
-    csi_transport, _ = await loop.create_datagram_endpoint(
-        lambda: CsiUdpServerProtocol(),
-        local_addr=(UDP_HOST, CSI_UDP_PORT),
-    )
+    if CSI_MULTICAST_GROUP:
+        csi_transport, csi_protocol = await loop.create_datagram_endpoint(
+            lambda: CsiUdpServerProtocol(),
+            sock=multicast_socket(CSI_MULTICAST_GROUP, CSI_UDP_PORT),
+        )
+    else:
+        csi_transport, csi_protocol = await loop.create_datagram_endpoint(
+            lambda: CsiUdpServerProtocol(),
+            local_addr=(UDP_HOST, CSI_UDP_PORT),
+        )
 
     image_transport, _ = await loop.create_datagram_endpoint(
         lambda: ImageUdpServerProtocol(),
@@ -152,6 +301,9 @@ async def main():
     )
 
     stats_task = asyncio.create_task(stats_printer())
+    headroom_task = asyncio.create_task(headroom_reporter(csi_protocol))
+    metrics_server = await start_http_server(metrics, METRICS_HOST, METRICS_PORT)
+    logger.info(f'Metrics on http://{METRICS_HOST}:{METRICS_PORT}/metrics')
 
     try:
         logger.info('Servers are running. Press Ctrl+C to stop.')
@@ -161,11 +313,13 @@ async def main():
         pass
     finally:
         stats_task.cancel()
+        headroom_task.cancel()
         try:
             await stats_task
         except asyncio.CancelledError:
             pass
 
+        metrics_server.close()
         csi_transport.close()
         image_transport.close()
         
@@ -175,6 +329,7 @@ async def main():
             pass
 
         executor.shutdown(wait=True)
+        image_pack.close()
         
         display_proc.join(timeout=5)
         if display_proc.is_alive():
@@ -0,0 +1,75 @@
+"""Checks that StreamingEncoder matches a full-window encode of the same frames.
+
+Frames are streamed through the cached encoder, and at every hop its latent
+is compared with the VAE encoder run on the whole window. Recorded CSI from a
+session is used when one is given, random frames otherwise. Exits non-zero if
+the largest difference, relative to the latent's magnitude, exceeds the tolerance.
+
+    python check_streaming_encoder.py --session ../01_Data_Collection/media/<timestamp>
+"""
+import argparse
+import sys
+from collections import deque
+
+import numpy as np
+import torch
+
+from export_encoder import NUM_SUBCARRIERS, WINDOW_SIZE, load_amplitudes
+from streaming_encoder import StreamingEncoder
+
+
+def frame_source(session, count, rng):
+    if session is not None:
+        amplitudes = load_amplitudes(session)
+        if len(amplitudes) < count:
+            sys.exit(f'{session} has fewer than {count} CSI frames')
+        return amplitudes[:count]
+    return rng.uniform(0, 40, (count, NUM_SUBCARRIERS)).astype(np.float32)
+
+
+def check_parity(model, frames, window_size, hop, device):
+    """Largest relative difference between the streamed and the full-window latent over all hops."""
+    stream = StreamingEncoder(model.encoder, window_size, device)
+    window = deque(maxlen=window_size)
+    worst = 0.0
+
+    for step, frame in enumerate(frames):
+        stream.push('parity', frame)
+        window.append(frame)
+        if len(window) < window_size or (step + 1 - window_size) % hop:
+            continue
+
+        with torch.no_grad():
+            full = torch.from_numpy(np.stack(window)[None]).to(device)
+            expected = model.encoder.encode(full)[0]
+        actual = stream.encode(['parity'])
+        difference = (actual - expected).abs().max() / (expected.abs().max() + 1.0)
+        worst = max(worst, difference.item())
+    return worst
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--checkpoint', default='trained_models/epoch=26-val_loss=389.5090.ckpt')
+    parser.add_argument('--session', default=None, help='session directory with csi.csv; random frames if omitted')
+    parser.add_argument('--hop', type=int, default=5)
+    parser.add_argument('--steps', type=int, default=40, help='hops to compare')
+    parser.add_argument('--tolerance', type=float, default=1e-4)
+    args = parser.parse_args()
+
+    from models.vae import VAE
+
+    model = VAE.load_from_checkpoint(args.checkpoint, window_size=WINDOW_SIZE, num_subcarriers=NUM_SUBCARRIERS,
+                                     map_location='cpu')
+    model.eval()
+
+    frames = frame_source(args.session, WINDOW_SIZE + args.steps * args.hop, np.random.default_rng(0))
+    worst = check_parity(model, frames, WINDOW_SIZE, args.hop, torch.device('cpu'))
+    print(f'Largest relative difference over {args.steps} hops: {worst:.2e}')
+    if worst > args.tolerance:
+        sys.exit(f'Streaming encoder differs from a full-window encode (above {args.tolerance:.0e})')
+    print('Streaming encoder matches the full-window encode.')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,149 @@
+import multiprocessing
+from multiprocessing import shared_memory
+from time import monotonic
+
+import numpy as np
+
+
+CSI_DATA_LENGTH = 256
+SOURCE_LENGTH = 40
+
+RECORD_DTYPE = np.dtype([
+    ('source', f'S{SOURCE_LENGTH}'),
+    ('timestamp', '<u4'),
+    ('received', '<f8'),
+    ('rssi', 'i1'),
+    ('data', 'i1', (CSI_DATA_LENGTH,)),
+])
+
+# Producer and consumer counters sit on separate cache lines.
+HEADER_SIZE = 128
+WRITE, DROPPED, PARSE_ERRORS, CLOSED = 0, 1, 2, 3
+READ, LOAD = 8, 9
+
+# Column positions in the RX CSV line, counted from the quoted MAC.
+RSSI_FIELD = 5
+TIMESTAMP_FIELD = 20
+
+
+def parse_csi_record(text, record, source):
+    """Parses one RX line straight into a ring slot. Returns False if it is malformed."""
+    start = text.rfind('"[')
+    end = text.rfind(']"')
+    if start == -1 or end == -1:
+        return False
+
+    fields = text[:start].split(',')
+    try:
+        data = np.fromstring(text[start + 2:end], dtype=np.int8, sep=',')
+    except ValueError:
+        return False
+    if len(data) != CSI_DATA_LENGTH or len(fields) <= TIMESTAMP_FIELD:
+        return False
+
+    record['source'] = source.encode()[:SOURCE_LENGTH]
+    record['timestamp'] = int(fields[TIMESTAMP_FIELD])
+    record['received'] = monotonic()
+    record['rssi'] = int(fields[RSSI_FIELD])
+    record['data'] = data
+    return True
+
+
+class CsiRing:
+    """Single-producer/single-consumer ring of fixed-size CSI records in shared memory.
+
+    The producer fills a slot in place and only then publishes it by bumping the
+    write counter; the consumer reads the slot through a view and bumps the read
+    counter when done. A full ring rejects new records and counts them as dropped.
+
+    Plain stores to shared memory are not ordered across processes on weakly
+    ordered CPUs, so both counters are only read and written under a shared lock.
+    Its acquire and release are the barriers that make a slot's contents visible
+    before its counter, in either direction.
+    """
+
+    def __init__(self, shm, capacity, lock):
+        self.shm = shm
+        self.capacity = capacity
+        self.lock = lock
+        self.header = np.ndarray((HEADER_SIZE // 8,), dtype=np.uint64, buffer=shm.buf)
+        self.records = np.ndarray((capacity,), dtype=RECORD_DTYPE, buffer=shm.buf, offset=HEADER_SIZE)
+
+    @classmethod
+    def create(cls, capacity=4096):
+        size = HEADER_SIZE + capacity * RECORD_DTYPE.itemsize
+        ring = cls(shared_memory.SharedMemory(create=True, size=size), capacity, multiprocessing.Lock())
+        ring.header[:] = 0
+        return ring
+
+    @classmethod
+    def attach(cls, name, capacity, lock):
+        """Opens a ring created in another process; lock is that ring's lock, passed to the process."""
+        return cls(shared_memory.SharedMemory(name=name), capacity, lock)
+
+    @property
+    def name(self):
+        return self.shm.name
+
+    def __len__(self):
+        return int(self.header[WRITE] - self.header[READ])
+
+    @property
+    def dropped(self):
+        return int(self.header[DROPPED])
+
+    @property
+    def parse_errors(self):
+        return int(self.header[PARSE_ERRORS])
+
+    @property
+    def load(self):
+        """Consumer's busy fraction over its last reporting interval, in permille."""
+        return int(self.header[LOAD])
+
+    def set_load(self, permille):
+        self.header[LOAD] = permille
+
+    @property
+    def closed(self):
+        return bool(self.header[CLOSED])
+
+    def push(self, text, source):
+        with self.lock:
+            write = int(self.header[WRITE])
+            read = int(self.header[READ])
+        if write - read >= self.capacity:
+            self.header[DROPPED] += 1
+            return False
+
+        if not parse_csi_record(text, self.records[write % self.capacity], source):
+            self.header[PARSE_ERRORS] += 1
+            return False
+
+        with self.lock:
+            self.header[WRITE] = write + 1
+        return True
+
+    def peek(self):
+        """Zero-copy view of the oldest record, valid until advance(); None if empty."""
+        with self.lock:
+            read = int(self.header[READ])
+            write = int(self.header[WRITE])
+        if read == write:
+            return None
+        return self.records[read % self.capacity]
+
+    def advance(self):
+        with self.lock:
+            self.header[READ] += 1
+
+    def shutdown(self):
+        """Tells the consumer to stop once it next checks closed."""
+        self.header[CLOSED] = 1
+
+    def close(self, unlink=False):
+        self.shutdown()
+        del self.header, self.records
+        self.shm.close()
+        if unlink:
+            self.shm.unlink()
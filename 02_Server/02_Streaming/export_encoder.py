@@ -0,0 +1,246 @@
+"""Exports the VAE encoder as the int8 C implementation in 01_Embedded/components/vae_encoder.
+
+Weights are quantized per output channel and activations per tensor, with
+activation ranges calibrated on windows from a recorded session. After writing
+vae_encoder_weights.h the C encoder is built for the host and its latents are
+compared against the PyTorch encoder on the same windows.
+
+    python export_encoder.py --session ../01_Data_Collection/media/<timestamp>
+"""
+import argparse
+import ctypes
+import json
+import os
+import subprocess
+import sys
+import tempfile
+from pathlib import Path
+
+import numpy as np
+import pandas as pd
+
+
+CSI_VALID_SUBCARRIER_INDEX = [i for i in range(6, 32)] + [i for i in range(33, 59)]
+NUM_SUBCARRIERS = len(CSI_VALID_SUBCARRIER_INDEX)
+WINDOW_SIZE = 151
+LEAKY_SLOPE = 0.01
+CALIBRATION_PERCENTILE = 99.99
+MIN_COSINE = 0.99
+
+current_folder = Path(__file__).resolve().parent
+component_dir = current_folder.parent.parent / '01_Embedded' / 'components' / 'vae_encoder'
+
+# (state_dict prefix, LeakyReLU after it) in forward order.
+ENCODER_LAYERS = [
+    ('encoder.subcarrier_encoder.0', True),
+    ('encoder.subcarrier_encoder.2', False),
+    ('encoder.latent_encoder.0', True),
+    ('encoder.latent_encoder.2', True),
+    ('encoder.latent_encoder.4', True),
+    ('encoder.mu', False),
+]
+
+
+def latest_session():
+    media = current_folder.parent / '01_Data_Collection' / 'media'
+    sessions = sorted(p for p in media.glob('*') if (p / 'csi.csv').is_file())
+    return sessions[-1] if sessions else None
+
+
+def load_amplitudes(session_dir):
+    df = pd.read_csv(os.path.join(session_dir, 'csi.csv'))
+    raw = np.array([json.loads(x) for x in df['data'].values], dtype=np.int32).reshape(len(df), -1)
+    real = raw[:, [i * 2 for i in CSI_VALID_SUBCARRIER_INDEX]]
+    imag = raw[:, [i * 2 - 1 for i in CSI_VALID_SUBCARRIER_INDEX]]
+    return np.sqrt(real**2 + imag**2).astype(np.float32)
+
+
+def extract_layers(state_dict):
+    return [
+        (state_dict[f'{name}.weight'].cpu().numpy().astype(np.float64),
+         state_dict[f'{name}.bias'].cpu().numpy().astype(np.float64),
+         leaky)
+        for name, leaky in ENCODER_LAYERS
+    ]
+
+
+def leaky_relu(x):
+    return np.where(x >= 0, x, x * LEAKY_SLOPE)
+
+
+def float_activations(layers, windows):
+    """Input and output of every layer for windows of shape (N, WINDOW_SIZE, NUM_SUBCARRIERS)."""
+    x = windows.astype(np.float64)
+    activations = [x]
+    for i, (weight, bias, leaky) in enumerate(layers):
+        if i == 2:
+            x = x.reshape(len(windows), -1)
+        x = x @ weight.T + bias
+        if leaky:
+            x = leaky_relu(x)
+        activations.append(x)
+    return activations
+
+
+def calibrate(activations):
+    return [max(np.percentile(np.abs(a), CALIBRATION_PERCENTILE), 1e-8) / 127.0 for a in activations]
+
+
+def quantize_multiplier(multiplier):
+    """Splits a positive real factor into a Q31 mantissa and a shift: m * 2^-(31 + shift)."""
+    mantissa, exponent = np.frexp(multiplier)
+    mult = np.round(mantissa * (1 << 31)).astype(np.int64)
+    overflow = mult == (1 << 31)
+    mult[overflow] //= 2
+    exponent[overflow] += 1
+    shift = -exponent
+    if np.any(31 + shift < 1) or np.any(31 + shift > 62):
+        raise ValueError('Requantization factor out of range')
+    return mult.astype(np.int32), shift.astype(np.int8)
+
+
+def quantize_layers(layers, scales):
+    quantized = []
+    for i, (weight, bias, leaky) in enumerate(layers):
+        input_scale, output_scale = scales[i], scales[i + 1]
+        weight_scale = np.maximum(np.abs(weight).max(axis=1), 1e-12) / 127.0
+
+        layer = {
+            'weight': np.clip(np.round(weight / weight_scale[:, None]), -127, 127).astype(np.int8),
+            'bias': np.round(bias / (input_scale * weight_scale)).astype(np.int32),
+        }
+        multiplier = input_scale * weight_scale / output_scale
+        layer['mult'], layer['shift'] = quantize_multiplier(multiplier)
+        if leaky:
+            layer['mult_neg'], layer['shift_neg'] = quantize_multiplier(multiplier * LEAKY_SLOPE)
+        quantized.append(layer)
+    return quantized
+
+
+def c_array(ctype, name, values, per_line=32):
+    values = np.asarray(values).ravel()
+    lines = [', '.join(str(v) for v in values[i:i + per_line]) for i in range(0, len(values), per_line)]
+    return f'static const {ctype} {name}[{len(values)}] = {{\n    ' + ',\n    '.join(lines) + '\n};\n'
+
+
+def write_header(path, quantized, scales, checkpoint):
+    parts = [
+        '#pragma once\n',
+        f'/* Generated by 02_Server/02_Streaming/export_encoder.py from {Path(checkpoint).name}. Do not edit. */\n',
+        '#include <stdint.h>\n',
+        f'#define VAE_ENC_INPUT_SCALE   {scales[0]:.9e}f',
+        f'#define VAE_ENC_LATENT_SCALE  {scales[-1]:.9e}f\n',
+    ]
+    for n, layer in enumerate(quantized):
+        parts.append(c_array('int8_t', f'VAE_ENC_W{n}', layer['weight']))
+        parts.append(c_array('int32_t', f'VAE_ENC_B{n}', layer['bias']))
+        parts.append(c_array('int32_t', f'VAE_ENC_M{n}', layer['mult']))
+        parts.append(c_array('int8_t', f'VAE_ENC_S{n}', layer['shift']))
+        if 'mult_neg' in layer:
+            parts.append(c_array('int32_t', f'VAE_ENC_MN{n}', layer['mult_neg']))
+            parts.append(c_array('int8_t', f'VAE_ENC_SN{n}', layer['shift_neg']))
+
+    with open(path, 'w') as f:
+        f.write('\n'.join(parts))
+
+
+def build_host_library(out_dir, cc):
+    library = os.path.join(out_dir, 'libvae_encoder.so')
+    subprocess.run([
+        cc, '-O2', '-shared', '-fPIC',
+        '-I', str(component_dir / 'include'), '-I', str(component_dir),
+        str(component_dir / 'vae_encoder.c'), '-o', library, '-lm',
+    ], check=True)
+
+    lib = ctypes.CDLL(library)
+    lib.vae_encoder_window_size.restype = ctypes.c_size_t
+    lib.vae_encoder_latent_scale.restype = ctypes.c_float
+    return lib
+
+
+def host_latents(lib, sequences):
+    """Runs the C encoder over each sequence and returns the latent of its last WINDOW_SIZE frames."""
+    window = ctypes.create_string_buffer(lib.vae_encoder_window_size())
+    scale = lib.vae_encoder_latent_scale()
+    latents = []
+    for sequence in sequences:
+        lib.vae_encoder_window_reset(window)
+        for frame in np.ascontiguousarray(sequence, dtype=np.float32):
+            lib.vae_encoder_push(window, frame.ctypes.data_as(ctypes.POINTER(ctypes.c_float)))
+        mu = np.zeros(128, dtype=np.int8)
+        lib.vae_encoder_latent(window, mu.ctypes.data_as(ctypes.POINTER(ctypes.c_int8)))
+        latents.append(mu.astype(np.float32) * scale)
+    return np.stack(latents)
+
+
+def compare(reference, actual):
+    error = np.abs(reference - actual)
+    cosine = np.sum(reference * actual, axis=1) / (
+        np.linalg.norm(reference, axis=1) * np.linalg.norm(actual, axis=1) + 1e-12)
+    print(f'max abs error {error.max():.4f}, mean abs error {error.mean():.4f}, '
+          f'|mu| mean {np.abs(reference).mean():.4f}')
+    print(f'cosine similarity: mean {cosine.mean():.5f}, min {cosine.min():.5f}')
+    return cosine.min() >= MIN_COSINE
+
+
+def sample_sequences(amplitudes, count, rng):
+    """Sequences longer than a window at random offsets, so the ring buffer wraps in the check."""
+    sequences = []
+    for _ in range(count):
+        length = WINDOW_SIZE + int(rng.integers(0, WINDOW_SIZE))
+        start = int(rng.integers(0, len(amplitudes) - length + 1))
+        sequences.append(amplitudes[start:start + length])
+    return sequences
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--checkpoint', default='trained_models/epoch=26-val_loss=389.5090.ckpt')
+    parser.add_argument('--session', default=None, help='session directory with csi.csv for calibration')
+    parser.add_argument('--windows', type=int, default=256, help='calibration and check windows')
+    parser.add_argument('--out', default=str(component_dir / 'vae_encoder_weights.h'))
+    parser.add_argument('--cc', default=os.environ.get('CC', 'cc'))
+    parser.add_argument('--no-check', action='store_true', help='skip the host build and comparison')
+    args = parser.parse_args()
+
+    import torch
+    from models.vae import VAE
+
+    session = args.session or latest_session()
+    if session is None:
+        sys.exit('No session with csi.csv found; pass --session')
+
+    model = VAE.load_from_checkpoint(args.checkpoint, window_size=WINDOW_SIZE, num_subcarriers=NUM_SUBCARRIERS,
+                                     map_location='cpu')
+    model.eval()
+
+    amplitudes = load_amplitudes(session)
+    if len(amplitudes) < 2 * WINDOW_SIZE:
+        sys.exit(f'{session} has too few CSI frames for calibration')
+
+    rng = np.random.default_rng(0)
+    calibration = np.stack([s[-WINDOW_SIZE:] for s in sample_sequences(amplitudes, args.windows, rng)])
+
+    layers = extract_layers(model.state_dict())
+    scales = calibrate(float_activations(layers, calibration))
+    write_header(args.out, quantize_layers(layers, scales), scales, args.checkpoint)
+    print(f'Wrote {args.out} (calibrated on {len(calibration)} windows from {session})')
+
+    if args.no_check:
+        return
+
+    sequences = sample_sequences(amplitudes, args.windows, rng)
+    with torch.no_grad():
+        windows = torch.from_numpy(np.stack([s[-WINDOW_SIZE:] for s in sequences]))
+        reference = model.encoder.encode(windows)[0].numpy()
+
+    with tempfile.TemporaryDirectory() as out_dir:
+        actual = host_latents(build_host_library(out_dir, args.cc), sequences)
+
+    if not compare(reference, actual):
+        sys.exit(f'Host encoder disagrees with PyTorch (cosine similarity below {MIN_COSINE})')
+    print('Host encoder matches PyTorch.')
+
+
+if __name__ == '__main__':
+    main()
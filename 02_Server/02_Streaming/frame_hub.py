@@ -0,0 +1,68 @@
+import asyncio
+import re
+import threading
+
+
+def source_key(source):
+    """Name a source is published and subscribed under: its address with separators as dashes."""
+    return re.sub(r'[^0-9A-Za-z]+', '-', source)
+
+
+class FrameHub:
+    """Latest encoded frame per source, pushed to WebSocket clients when it changes.
+
+    The inference process encodes each result once and writes it to a pipe as
+    b'<source>\\0<jpeg>'. A reader thread hands it to the event loop, which keeps
+    it as the source's latest frame and offers the bytes to every subscriber.
+    Each client has a one-slot mailbox, so a slow client only ever skips to the
+    newest frame.
+    """
+
+    def __init__(self):
+        self.frames = {}
+        self.clients = {}
+        self.loop = None
+
+    def start(self, reader):
+        self.loop = asyncio.get_running_loop()
+        threading.Thread(target=self.pump, args=(reader,), daemon=True).start()
+
+    def pump(self, reader):
+        while True:
+            try:
+                message = reader.recv_bytes()
+            except (EOFError, OSError):
+                break
+            source, _, frame = message.partition(b'\0')
+            self.loop.call_soon_threadsafe(self.publish, source.decode(), frame)
+
+    def publish(self, source, frame):
+        self.frames[source] = frame
+        self.frames[None] = frame
+
+        for mailbox, subscription in self.clients.items():
+            if subscription == source or subscription is None:
+                offer(mailbox, frame)
+
+    def subscribe(self, source=None):
+        if source is not None:
+            source = source_key(source)
+        mailbox = asyncio.Queue(maxsize=1)
+        self.clients[mailbox] = source
+        latest = self.frames.get(source)
+        if latest is not None:
+            offer(mailbox, latest)
+        return mailbox
+
+    def unsubscribe(self, mailbox):
+        self.clients.pop(mailbox, None)
+
+    @property
+    def sources(self):
+        return sorted(source for source in self.frames if source is not None)
+
+
+def offer(mailbox, frame):
+    if mailbox.full():
+        mailbox.get_nowait()
+    mailbox.put_nowait(frame)
@@ -0,0 +1,151 @@
+from bisect import bisect_right
+from collections import deque
+
+import numpy as np
+
+
+TIMESTAMP_WRAP = 1 << 32
+FILL_POLICIES = ('hold', 'linear', 'zero', 'reset')
+
+
+class ClockModel:
+    """Maps RX time to host time, tracking the drift between the two clocks.
+
+    Network and queueing delay only ever add to the observed offset, so the
+    minimum offset in each bin is taken as the transit floor and a line through
+    the recent floors gives the drift.
+    """
+
+    def __init__(self, bin_seconds=1.0, bins=30):
+        self.bin_seconds = bin_seconds
+        self.floors = deque(maxlen=bins)
+        self.intercept = None
+        self.slope = 0.0
+        self.origin = 0.0
+
+    def update(self, rx_time, host_time):
+        offset = host_time - rx_time
+        index = int(rx_time // self.bin_seconds)
+
+        if self.floors and self.floors[-1][0] == index:
+            if offset < self.floors[-1][2]:
+                self.floors[-1] = (index, rx_time, offset)
+                self.fit()
+        elif not self.floors or index > self.floors[-1][0]:
+            self.floors.append((index, rx_time, offset))
+            self.fit()
+
+    def fit(self):
+        _, x, y = zip(*self.floors)
+        if len(x) < 3:
+            self.origin, self.intercept, self.slope = x[-1], min(y), 0.0
+            return
+        self.origin = x[0]
+        self.slope, self.intercept = np.polyfit(np.asarray(x) - self.origin, y, 1)
+
+    @property
+    def drift_ppm(self):
+        return self.slope * 1e6
+
+    def host_time(self, rx_time):
+        return rx_time + self.intercept + self.slope * (rx_time - self.origin)
+
+
+class JitterBuffer:
+    """Reorders one source's CSI by RX timestamp and resamples it onto a fixed-rate grid.
+
+    A grid tick is emitted once the host clock passes its expected arrival time
+    plus delay, so output latency is bounded by the delay budget no matter how
+    the gateway bursts. Ticks are linearly interpolated between the surrounding
+    samples. If those are further apart than interp_gap, the tick is filled
+    according to fill; a gap longer than reset_gap, or any gap under the 'reset'
+    policy, restarts the grid and is reported as None in the output.
+    """
+
+    def __init__(self, rate, delay=0.1, fill='hold', interp_gap=None, reset_gap=1.0):
+        if fill not in FILL_POLICIES:
+            raise ValueError(f'Unknown fill policy: {fill}')
+
+        self.period = 1.0 / rate
+        self.delay = delay
+        self.fill = fill
+        self.interp_gap = interp_gap if interp_gap is not None else 2.5 * self.period
+        self.reset_gap = reset_gap
+        self.clock = ClockModel()
+
+        self.times = []
+        self.values = []
+        self.next_tick = None
+        self.last_raw = None
+        self.last_time = 0
+
+        self.late = 0
+        self.filled = 0
+        self.resets = 0
+
+    def unwrap(self, timestamp):
+        """Extends the 32-bit microsecond RX timestamp, relative to the newest one seen."""
+        if self.last_raw is None:
+            self.last_raw, self.last_time = timestamp, timestamp
+            return timestamp
+
+        delta = (timestamp - self.last_raw + TIMESTAMP_WRAP // 2) % TIMESTAMP_WRAP - TIMESTAMP_WRAP // 2
+        value = self.last_time + delta
+        if delta > 0:
+            self.last_raw, self.last_time = timestamp, value
+        return value
+
+    def push(self, timestamp, received, amplitude):
+        rx_time = self.unwrap(int(timestamp)) * 1e-6
+        self.clock.update(rx_time, received)
+
+        if self.next_tick is not None and rx_time < self.next_tick - self.period:
+            self.late += 1
+            return
+
+        index = bisect_right(self.times, rx_time)
+        self.times.insert(index, rx_time)
+        self.values.insert(index, np.asarray(amplitude, dtype=np.float32))
+
+    def poll(self, now):
+        """Returns the grid frames due by host time now; None marks a restart of the grid."""
+        frames = []
+        if self.next_tick is None:
+            if not self.times:
+                return frames
+            self.next_tick = self.times[0]
+
+        while self.next_tick is not None and now >= self.clock.host_time(self.next_tick) + self.delay:
+            tick = self.next_tick
+            i = bisect_right(self.times, tick)
+            if i == 0:
+                self.next_tick += self.period
+                continue
+
+            prev_time, prev_value = self.times[i - 1], self.values[i - 1]
+            has_next = i < len(self.times)
+            gap = (self.times[i] if has_next else tick) - prev_time
+
+            if gap > self.reset_gap or (gap > self.interp_gap and self.fill == 'reset'):
+                self.resets += 1
+                frames.append(None)
+                del self.times[:i], self.values[:i]
+                self.next_tick = self.times[0] if self.times else None
+                continue
+
+            if has_next and (gap <= self.interp_gap or self.fill == 'linear'):
+                weight = (tick - prev_time) / (self.times[i] - prev_time)
+                value = prev_value + weight * (self.values[i] - prev_value)
+            elif gap > self.interp_gap and self.fill == 'zero':
+                value = np.zeros_like(prev_value)
+            else:
+                value = prev_value
+
+            if gap > self.interp_gap or (not has_next and tick - prev_time > self.period):
+                self.filled += 1
+
+            frames.append(value)
+            del self.times[:i - 1], self.values[:i - 1]
+            self.next_tick = tick + self.period
+
+        return frames
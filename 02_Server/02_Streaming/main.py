@@ -1,31 +1,61 @@
 import multiprocessing
 import asyncio
-import base64
-import json
-import os
+import queue
+import socket
+import struct
+import sys
+import time
 from contextlib import asynccontextmanager
+from pathlib import Path
 
 import numpy as np
 import torch
 import cv2
 from fastapi import FastAPI, WebSocket, WebSocketDisconnect
-from fastapi.responses import FileResponse
+from fastapi.responses import FileResponse, JSONResponse, PlainTextResponse
 from fastapi.staticfiles import StaticFiles
 from fastapi.middleware.cors import CORSMiddleware
 
 from models.vae import VAE
+from scheduler import BatchScheduler
+from frame_hub import FrameHub, source_key
+from csi_ring import CsiRing
+from jitter_buffer import JitterBuffer
+
+sys.path.append(str(Path(__file__).resolve().parent.parent / 'common'))
+from ingest_metrics import IngestMetrics, csi_head
 
 
 UDP_HOST = '0.0.0.0'
 INFERENCE_UDP_PORT = 8000
-CSI_DATA_LENGTH = 256
+# Set to the group of a gateway multicast sink (ADD_SINK) to receive it as well.
+INFERENCE_MULTICAST_GROUP = None
+LATE_PREFIX = b'LATE,'
+LATENT_PREFIX = 'LATENT,'
 CSI_VALID_SUBCARRIER_INDEX = [i for i in range(6, 32)] + [i for i in range(33, 59)]
 NUM_SUBCARRIERS = len(CSI_VALID_SUBCARRIER_INDEX)
 
-inference_interval = 50
-send_interval = 0.25
+inference_interval = 10
+max_batch_size = 16
+batch_deadline = 0.02
+jpeg_quality = 85
+ring_capacity = 4096
+csi_rate = 100
+jitter_delay = 0.08
+jitter_fill = 'hold'
+jitter_interp_gap = 0.06
+jitter_poll_interval = 0.005
+headroom_interval = 1.0
 csi_count = 0
-csi_queue = multiprocessing.Queue(maxsize=10)
+csi_ring = None
+parse_errors = {}
+latent_queue = multiprocessing.Queue(maxsize=64)
+# The worker sends its inference latencies here once per interval.
+latency_queue = multiprocessing.Queue(maxsize=16)
+frame_reader, frame_writer = multiprocessing.Pipe(duplex=False)
+frame_hub = FrameHub()
+metrics = IngestMetrics('csi_streaming')
+inference_latency = metrics.summary('inference_latency_seconds', 'Time to run one inference batch and publish its frames.')
 
 if torch.backends.mps.is_available():
     device = torch.device('mps')
@@ -45,95 +75,241 @@ model.to(device)
 model.eval()
 
 
+def current_headroom(last_dropped):
+    """Permille of spare capacity: the lower of free ring space and idle worker time."""
+    if csi_ring.dropped > last_dropped:
+        return 0
+    fill = len(csi_ring) / ring_capacity
+    return max(0, int(1000 * (1 - max(fill, csi_ring.load / 1000))))
+
+
+async def headroom_reporter(protocol):
+    """Tells every gateway heard from in the last interval how much capacity is left."""
+    last_dropped = 0
+    while True:
+        await asyncio.sleep(headroom_interval)
+        message = f'HEADROOM:{current_headroom(last_dropped)}\n'.encode()
+        last_dropped = csi_ring.dropped
+        for addr in protocol.gateways:
+            protocol.transport.sendto(message, addr)
+        protocol.gateways.clear()
+
+
+def queue_depth(q):
+    try:
+        return q.qsize()
+    except NotImplementedError:
+        return -1
+
+
+def register_metrics():
+    metrics.gauge('ring_depth', 'CSI records waiting in the ring for the inference worker.', lambda: len(csi_ring))
+    metrics.gauge('ring_capacity', 'Size of the CSI ring.', lambda: ring_capacity)
+    metrics.gauge('ring_dropped_total', 'CSI records dropped because the ring was full.',
+                  lambda: csi_ring.dropped, kind='counter')
+    metrics.gauge('parse_errors_total', 'Rejected CSI records by reason.',
+                  lambda: {'reason="ring"': csi_ring.parse_errors, **parse_errors}, kind='counter')
+    metrics.gauge('latent_queue_depth', 'Device-encoded latents waiting for the decoder.', lambda: queue_depth(latent_queue))
+    metrics.gauge('worker_load', 'Busy fraction of the inference worker over its last interval.',
+                  lambda: csi_ring.load / 1000)
+    metrics.gauge('websocket_clients', 'Connected display clients.', lambda: len(frame_hub.clients))
+
+
 async def stats_printer():
     global csi_count
     while True:
         await asyncio.sleep(1.0)
-        print(f'[STATS] CSI: {csi_count} Hz')
+        metrics.tick(1.0)
+        while True:
+            try:
+                latencies = latency_queue.get_nowait()
+            except queue.Empty:
+                break
+            for seconds in latencies:
+                inference_latency.observe(seconds)
+        print(f'[STATS] CSI: {csi_count} Hz | ring: {len(csi_ring)}/{ring_capacity}, '
+              f'dropped {csi_ring.dropped}, malformed {csi_ring.parse_errors}')
         csi_count = 0
 
 
-def extract_csi_data(decoded_data):
-    start_index = decoded_data.rfind('[')
-    end_index = decoded_data.rfind(']')
-    if start_index == -1 or end_index == -1:
-        return None
-    
-    csi_string = decoded_data[start_index:end_index+1]
-    try:
-        return json.loads(csi_string)
-    except:
-        return None
+def extract_source(addr, decoded_data):
+    """Identifies a CSI link by the gateway that relayed it and the MAC it was measured from."""
+    mac = decoded_data[1:18] if decoded_data.startswith('"') else 'unknown'
+    return f'{addr}-{mac}'
 
 
-def inference_worker(queue):
-    csi = []
-    while True:
-        try:
-            decoded_data = queue.get()
-            if decoded_data is None:
-                print("Inference worker received shutdown signal.")
-                break
+def parse_latent(decoded_data):
+    """Splits 'LATENT,"mac",tx_id,seq,timestamp,scale,"[q0,...]"' into the record head and the latent mean."""
+    record = decoded_data[len(LATENT_PREFIX):]
+    start = record.rfind('"[')
+    end = record.rfind(']"')
+    if start == -1 or end == -1:
+        return None, None
+
+    fields = record[:start].split(',')
+    values = np.array(record[start + 2:end].split(','), dtype=np.float32)
+    return record, values * float(fields[4])
 
-            csi_data = extract_csi_data(decoded_data)
-            if csi_data is None or len(csi_data) != CSI_DATA_LENGTH:
-                continue
-            
-            csi.append(csi_data)
-            if len(csi) < window_size:
-                continue
-            
-            csi_array = np.array(csi[:window_size], dtype=np.int32)
-
-            real = csi_array[:, [i * 2 for i in CSI_VALID_SUBCARRIER_INDEX]]
-            imag = csi_array[:, [i * 2 - 1 for i in CSI_VALID_SUBCARRIER_INDEX]]
-            spectrogram = np.sqrt(real**2 + imag**2).astype(np.float32)[np.newaxis, :, :]
-            spectrogram = torch.from_numpy(spectrogram)
-            spectrogram = spectrogram.to(device)
-
-            with torch.no_grad():
-                reconstruction = model.decode(model.encode(spectrogram))
-            
-            image = reconstruction.permute(0, 2, 3, 1).cpu().numpy()
-            image = image[0][..., ::-1]
-            image = np.clip(image, 0, 1)
-            image = (image * 255).astype(np.uint8)
-
-            os.makedirs('media', exist_ok=True)
-            np.save('media/image.npy', image)
-            csi = csi[inference_interval:]
+
+def multicast_socket(group, port):
+    """UDP socket bound to port that has joined group, shareable with other servers on this host."""
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind((UDP_HOST, port))
+    membership = struct.pack('4s4s', socket.inet_aton(group), socket.inet_aton('0.0.0.0'))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+    return sock
+
+
+def publish_image(frames, source, image):
+    result, buffer = cv2.imencode('.jpeg', image, [int(cv2.IMWRITE_JPEG_QUALITY), jpeg_quality])
+    if result:
+        frames.send_bytes(source_key(source).encode() + b'\0' + buffer.tobytes())
+
+
+def inference_worker(ring_name, ring_lock, latents, frames, latency_reports):
+    ring = CsiRing.attach(ring_name, ring_capacity, ring_lock)
+    scheduler = BatchScheduler(
+        model, device, window_size, inference_interval,
+        max_batch=max_batch_size, deadline=batch_deadline,
+    )
+    latencies = []
+    real_index = [i * 2 for i in CSI_VALID_SUBCARRIER_INDEX]
+    imag_index = [i * 2 - 1 for i in CSI_VALID_SUBCARRIER_INDEX]
+
+    buffers = {}
+    last_poll = 0.0
+    load_start = time.monotonic()
+    idle = 0.0
+
+    while not ring.closed:
+        try:
+            record = ring.peek()
+            if record is not None:
+                source = record['source'].decode()
+                buffer = buffers.get(source)
+                if buffer is None:
+                    buffer = buffers[source] = JitterBuffer(
+                        csi_rate, delay=jitter_delay, fill=jitter_fill, interp_gap=jitter_interp_gap,
+                    )
+
+                csi_array = record['data'].astype(np.int32)
+                timestamp, received = int(record['timestamp']), float(record['received'])
+                ring.advance()
+
+                real = csi_array[real_index]
+                imag = csi_array[imag_index]
+                buffer.push(timestamp, received, np.sqrt(real**2 + imag**2))
+
+            now = time.monotonic()
+            if now - last_poll >= jitter_poll_interval:
+                last_poll = now
+                for source, buffer in buffers.items():
+                    for amplitude in buffer.poll(now):
+                        if amplitude is None:
+                            print(f'[JITTER] {source}: gap, window restarted '
+                                  f'(drift {buffer.clock.drift_ppm:.1f} ppm, filled {buffer.filled}, late {buffer.late})')
+                            scheduler.reset(source)
+                        else:
+                            scheduler.push(source, amplitude)
+
+            pending_latents = []
+            while len(pending_latents) < max_batch_size:
+                try:
+                    pending_latents.append(latents.get_nowait())
+                except queue.Empty:
+                    break
+            if pending_latents:
+                started = time.monotonic()
+                for source, image in scheduler.decode(pending_latents):
+                    publish_image(frames, source, image)
+                latencies.append(time.monotonic() - started)
+
+            if scheduler.due():
+                started = time.monotonic()
+                for source, image in scheduler.run():
+                    publish_image(frames, source, image)
+                latencies.append(time.monotonic() - started)
+            elif record is None:
+                time.sleep(0.001)
+                idle += 0.001
+
+            if now - load_start >= headroom_interval:
+                ring.set_load(max(0, int(1000 * (1 - idle / (now - load_start)))))
+                if latencies:
+                    try:
+                        latency_reports.put_nowait(latencies)
+                    except queue.Full:
+                        pass
+                load_start, idle, latencies = now, 0.0, []
         except Exception as e:
             print(f'Inference Error: {e}')
 
+    print("Inference worker received shutdown signal.")
+    ring.close()
+
 
 class InferenceUdpServerProtocol:
+    def __init__(self):
+        self.transport = None
+        self.gateways = set()
+
     def connection_made(self, transport):
+        self.transport = transport
         print(f'UDP server started on {UDP_HOST}:{INFERENCE_UDP_PORT}')
 
     def datagram_received(self, data, addr):
         global csi_count
         try:
-            csi_count += 1
-            decoded_data = data.decode()
-            if not csi_queue.full():
-                csi_queue.put_nowait(decoded_data)
+            # Spooled records replayed after an uplink outage are too old to display.
+            if data.startswith(LATE_PREFIX):
+                return
+            self.gateways.add(addr)
+            # Under load the gateway packs several records into one datagram.
+            for decoded_data in data.decode().splitlines():
+                csi_count += 1
+                if decoded_data.startswith(LATENT_PREFIX):
+                    # Encoded on the RX; only the decoder runs here.
+                    record, mu = parse_latent(decoded_data)
+                    if mu is None:
+                        parse_errors['reason="latent"'] = parse_errors.get('reason="latent"', 0) + 1
+                    else:
+                        try:
+                            latent_queue.put_nowait((extract_source(addr[0], record), mu))
+                        except queue.Full:
+                            pass
+                    continue
+                if csi_ring.push(decoded_data, extract_source(addr[0], decoded_data)):
+                    metrics.record(addr[0], *csi_head(decoded_data))
         except Exception as e:
+            parse_errors['reason="decode"'] = parse_errors.get('reason="decode"', 0) + 1
             print(f'Inference UDP Error: {e}')
 
 
 @asynccontextmanager
 async def lifespan(app: FastAPI):
+    global csi_ring
     loop = asyncio.get_running_loop()
 
-    inference_proc = multiprocessing.Process(target=inference_worker, args=(csi_queue, ))
+    csi_ring = CsiRing.create(ring_capacity)
+    register_metrics()
+    inference_proc = multiprocessing.Process(target=inference_worker, args=(csi_ring.name, csi_ring.lock, latent_queue, frame_writer, latency_queue))
     inference_proc.start()
+    frame_hub.start(frame_reader)
 
     asyncio.create_task(stats_printer())
 
-    inference_transport, _ = await loop.create_datagram_endpoint(
-        lambda: InferenceUdpServerProtocol(),
-        local_addr=(UDP_HOST, INFERENCE_UDP_PORT)
-    )
+    if INFERENCE_MULTICAST_GROUP:
+        inference_transport, inference_protocol = await loop.create_datagram_endpoint(
+            lambda: InferenceUdpServerProtocol(),
+            sock=multicast_socket(INFERENCE_MULTICAST_GROUP, INFERENCE_UDP_PORT)
+        )
+    else:
+        inference_transport, inference_protocol = await loop.create_datagram_endpoint(
+            lambda: InferenceUdpServerProtocol(),
+            local_addr=(UDP_HOST, INFERENCE_UDP_PORT)
+        )
+    asyncio.create_task(headroom_reporter(inference_protocol))
 
     print('UDP server startup sequence finished.')
     
@@ -141,12 +317,14 @@ async def lifespan(app: FastAPI):
 
     print('Closing UDP server...')
     inference_transport.close()
-    csi_queue.close()
-    csi_queue.join_thread() 
+    csi_ring.shutdown()
     inference_proc.join(timeout=5)
     if inference_proc.is_alive():
         print("Worker did not terminate, forcing termination...")
         inference_proc.terminate()
+    csi_ring.close(unlink=True)
+    latent_queue.close()
+    latency_queue.close()
 
 
 app = FastAPI(lifespan=lifespan)
@@ -164,27 +342,27 @@ async def get():
     return FileResponse('templates/display.html')
 
 
-def load_images():
-    image = np.load('media/image.npy')
-    encode_param = [int(cv2.IMWRITE_JPEG_QUALITY), 85]
-    result, buffer = cv2.imencode('.jpeg', image, encode_param)
-    if result:
-        image = base64.b64encode(buffer).decode('utf-8')
-        images = json.dumps({'image': image})
-        return images
-    else:
-        return None
+@app.get('/sources')
+async def get_sources():
+    return JSONResponse(frame_hub.sources)
+
+
+@app.get('/metrics')
+async def get_metrics():
+    return PlainTextResponse(metrics.render(), media_type='text/plain; version=0.0.4')
+
 
 @app.websocket('/ws')
 async def steam_csi_image(websocket: WebSocket):
     await websocket.accept()
+    mailbox = frame_hub.subscribe(websocket.query_params.get('source'))
     try:
         while True:
-            images = load_images()
-            if images is not None:
-                await websocket.send_text(images)
-            await asyncio.sleep(send_interval)
+            frame = await mailbox.get()
+            await websocket.send_bytes(frame)
     except WebSocketDisconnect:
         print("Websocket disconnected.")
     except Exception as e:
         print(f'error: {e}')
+    finally:
+        frame_hub.unsubscribe(mailbox)
@@ -0,0 +1,79 @@
+from time import monotonic
+
+import numpy as np
+import torch
+
+from streaming_encoder import StreamingEncoder
+
+
+class BatchScheduler:
+    """Runs ready windows from many CSI sources as one batched forward pass.
+
+    Every source keeps its own rolling window in a StreamingEncoder, so frames
+    shared between consecutive windows are only encoded once. A source becomes
+    ready once it holds window_size frames and at least hop new frames since its
+    last inference. Ready windows are collected until max_batch of them are waiting
+    or the oldest has waited deadline seconds, then run together on the shared model.
+    """
+
+    def __init__(self, model, device, window_size, hop, max_batch=16, deadline=0.02):
+        self.model = model
+        self.device = device
+        self.window_size = window_size
+        self.hop = hop
+        self.max_batch = max_batch
+        self.deadline = deadline
+
+        self.encoder = StreamingEncoder(model.encoder, window_size, device)
+        self.pending = {}
+        self.ready = {}
+
+    def push(self, source, amplitude):
+        if source not in self.pending:
+            self.pending[source] = self.window_size
+
+        self.encoder.push(source, amplitude)
+        self.pending[source] -= 1
+        if self.pending[source] <= 0 and source not in self.ready:
+            self.ready[source] = monotonic()
+
+    def reset(self, source):
+        """Discards a source's window, e.g. after a gap in its samples."""
+        self.encoder.reset(source)
+        self.pending.pop(source, None)
+        self.ready.pop(source, None)
+
+    def time_to_deadline(self):
+        """Seconds until the oldest ready window must run, or None if nothing is ready."""
+        if not self.ready:
+            return None
+        return max(0.0, min(self.ready.values()) + self.deadline - monotonic())
+
+    def due(self):
+        return len(self.ready) >= self.max_batch or self.time_to_deadline() == 0.0
+
+    def run(self):
+        """Returns a list of (source, BGR uint8 image) for every window run."""
+        sources = sorted(self.ready, key=self.ready.get)[:self.max_batch]
+        for source in sources:
+            del self.ready[source]
+            self.pending[source] = self.hop
+
+        with torch.no_grad():
+            reconstruction = self.model.decoder.decode(self.encoder.encode(sources))
+        return list(zip(sources, to_images(reconstruction)))
+
+    def decode(self, latents):
+        """Decodes latents encoded on the device; takes and returns lists of (source, ...)."""
+        sources = [source for source, _ in latents]
+        batch = torch.from_numpy(np.stack([mu for _, mu in latents])).to(self.device)
+
+        with torch.no_grad():
+            reconstruction = self.model.decoder.decode(batch)
+        return list(zip(sources, to_images(reconstruction)))
+
+
+def to_images(reconstruction):
+    images = reconstruction.permute(0, 2, 3, 1).cpu().numpy()
+    images = np.clip(images[..., ::-1], 0, 1)
+    return (images * 255).astype(np.uint8)
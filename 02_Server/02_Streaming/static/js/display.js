@@ -1,9 +1,10 @@
 const imageElement = document.getElementById('image')
 const statusElement = document.getElementById('status-message')
 
-const WEBSOCKET_URL = `ws://${window.location.host}/ws`
+const WEBSOCKET_URL = `ws://${window.location.host}/ws${window.location.search}`
 
 const socket = new WebSocket(WEBSOCKET_URL)
+socket.binaryType = 'blob'
 
 socket.onopen = (event) => {
     console.log("WebSocket connection established successfully!")
@@ -16,8 +17,11 @@ socket.onmessage = (event) => {
         imageElement.style.display = 'block'
     }
 
-    image = JSON.parse(event.data)
-    imageElement.src = "data:image/jpeg;base64," + image.image
+    const previous = imageElement.src
+    imageElement.src = URL.createObjectURL(new Blob([event.data], { type: 'image/jpeg' }))
+    if (previous.startsWith('blob:')) {
+        URL.revokeObjectURL(previous)
+    }
 }
 
 socket.onerror = (error) => {
@@ -0,0 +1,52 @@
+from collections import deque
+
+import numpy as np
+import torch
+
+
+class StreamingEncoder:
+    """VAE encoder that reuses per-frame work across overlapping windows.
+
+    The subcarrier encoder maps each frame on its own, so its output for a frame
+    never changes while the frame slides through the window: it is computed once,
+    when the frame is first needed, and cached per source. The latent encoder
+    starts with a dense layer over the whole flattened window, where every frame's
+    contribution depends on its position, so that part is recomputed each time,
+    but it is a small fraction of the full encoder cost.
+    """
+
+    def __init__(self, encoder, window_size, device):
+        self.encoder = encoder
+        self.window_size = window_size
+        self.device = device
+        self.features = {}
+        self.pending = {}
+
+    def push(self, source, amplitude):
+        pending = self.pending.get(source)
+        if pending is None:
+            pending = self.pending[source] = deque(maxlen=self.window_size)
+            self.features[source] = deque(maxlen=self.window_size)
+        pending.append(amplitude)
+
+    def reset(self, source):
+        self.pending.pop(source, None)
+        self.features.pop(source, None)
+
+    def encode(self, sources):
+        """Latent mean for the current window of each source, as a (len(sources), z_dim) tensor."""
+        counts = [len(self.pending[source]) for source in sources]
+        frames = [frame for source in sources for frame in self.pending[source]]
+
+        with torch.no_grad():
+            if frames:
+                batch = torch.from_numpy(np.asarray(frames, dtype=np.float32)).to(self.device)
+                new_features = self.encoder.subcarrier_encoder(batch)
+                for source, chunk in zip(sources, torch.split(new_features, counts)):
+                    self.features[source].extend(chunk)
+                    self.pending[source].clear()
+
+            windows = torch.stack([torch.stack(tuple(self.features[source])) for source in sources])
+            x = self.encoder.latent_encoder(torch.flatten(windows, start_dim=1))
+            return self.encoder.mu(x)
+
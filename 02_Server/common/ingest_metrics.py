@@ -0,0 +1,234 @@
+"""Ingest metrics shared by the collection and streaming servers.
+
+Counts every CSI record per source (the gateway that relayed it and the MAC it
+was measured from) and how many went missing, and renders everything in the
+Prometheus text exposition format. Gaps in the RX record counter were lost on
+the UART or the network. Between two records that carry the TX sequence number,
+frames the TX sent beyond what the RX forwarded were lost on the air. Records
+without an RX counter fall back to gaps in the RX timestamps.
+"""
+import asyncio
+from collections import deque
+
+import numpy as np
+
+
+TIMESTAMP_WRAP = 1 << 32
+SEQ_WRAP = 1 << 32
+# Larger sequence jumps mean a TX or RX restarted.
+MAX_SEQ_GAP = 1 << 20
+GAP_HISTORY = 64
+MIN_GAP_HISTORY = 8
+# A gap this many nominal intervals long counts as lost records.
+LOSS_GAP_FACTOR = 1.5
+# Longer gaps are treated as an RX restart rather than loss.
+MAX_GAP_US = 60_000_000
+QUANTILES = (0.5, 0.95, 0.99)
+
+# Column positions in the RX CSV line, counted from the quoted MAC.
+SEQ_FIELD = 2
+RX_SEQ_FIELD = 4
+TIMESTAMP_FIELD = 20
+
+
+def label_value(value):
+    """Escapes a label value as the text exposition format requires."""
+    return str(value).replace('\\', '\\\\').replace('"', '\\"').replace('\n', '\\n')
+
+
+def csi_head(text):
+    """Returns (mac, timestamp, seq, rx_seq) of an RX line; unknown values are None."""
+    end = text.find('"[')
+    if end == -1:
+        return None, None, None, None
+    fields = text[:end].split(',')
+    if len(fields) <= TIMESTAMP_FIELD:
+        return None, None, None, None
+    try:
+        seq, rx_seq = int(fields[SEQ_FIELD]), int(fields[RX_SEQ_FIELD])
+        return (fields[0].strip('"'), int(fields[TIMESTAMP_FIELD]),
+                seq if seq >= 0 else None, rx_seq if rx_seq >= 0 else None)
+    except ValueError:
+        return None, None, None, None
+
+
+class SourceStats:
+    """Received count, rate and loss of one source.
+
+    Without sequence numbers, loss is estimated from timestamp gaps against the
+    median of recent gaps, so it follows the TX rate when the rate controller
+    changes it.
+    """
+
+    def __init__(self):
+        self.received = 0
+        self.lost = 0
+        self.lost_air = 0
+        self.lost_transport = 0
+        self.rate = 0.0
+        self.window = 0
+        self.last_timestamp = None
+        self.last_rx_seq = None
+        self.last_paired = None
+        self.gaps = deque(maxlen=GAP_HISTORY)
+
+    def record(self, timestamp, seq=None, rx_seq=None):
+        self.received += 1
+        self.window += 1
+        if rx_seq is not None:
+            self.record_seq(seq, rx_seq)
+            return
+        if timestamp is None:
+            return
+
+        last, self.last_timestamp = self.last_timestamp, timestamp
+        if last is None:
+            return
+        gap = (timestamp - last) % TIMESTAMP_WRAP
+        if gap == 0 or gap > MAX_GAP_US:
+            return
+
+        if len(self.gaps) >= MIN_GAP_HISTORY:
+            nominal = float(np.median(self.gaps))
+            if gap > LOSS_GAP_FACTOR * nominal:
+                self.lost += int(round(gap / nominal)) - 1
+                return
+        self.gaps.append(gap)
+
+    def record_seq(self, seq, rx_seq):
+        """rx_seq is known for every record; seq only if the RX paired it with the sounding payload."""
+        last_rx_seq, self.last_rx_seq = self.last_rx_seq, rx_seq
+        if last_rx_seq is not None:
+            queued = (rx_seq - last_rx_seq) % SEQ_WRAP
+            if 0 < queued <= MAX_SEQ_GAP:
+                self.lost_transport += queued - 1
+                self.lost += queued - 1
+
+        if seq is None:
+            return
+        last, self.last_paired = self.last_paired, (seq, rx_seq)
+        if last is None:
+            return
+        sent = (seq - last[0]) % SEQ_WRAP
+        queued = (rx_seq - last[1]) % SEQ_WRAP
+        if sent == 0 or queued == 0 or sent > MAX_SEQ_GAP or queued > MAX_SEQ_GAP:
+            return
+        self.lost_air += max(0, sent - queued)
+        self.lost += max(0, sent - queued)
+
+    @property
+    def loss_ratio(self):
+        total = self.received + self.lost
+        return self.lost / total if total else 0.0
+
+
+class Summary:
+    """Quantiles over the most recent observations, plus running sum and count."""
+
+    def __init__(self, size=1024):
+        self.values = deque(maxlen=size)
+        self.count = 0
+        self.sum = 0.0
+
+    def observe(self, value):
+        self.values.append(value)
+        self.count += 1
+        self.sum += value
+
+    def quantiles(self):
+        if not self.values:
+            return {q: float('nan') for q in QUANTILES}
+        return dict(zip(QUANTILES, np.quantile(self.values, QUANTILES)))
+
+
+class IngestMetrics:
+    def __init__(self, namespace):
+        self.namespace = namespace
+        self.sources = {}
+        self.counters = {}
+        self.callbacks = {}
+        self.summaries = {}
+
+    def record(self, gateway, mac, timestamp, seq=None, rx_seq=None):
+        stats = self.sources.get((gateway, mac))
+        if stats is None:
+            stats = self.sources[(gateway, mac)] = SourceStats()
+        stats.record(timestamp, seq, rx_seq)
+
+    def count(self, name, help, labels='', n=1):
+        values = self.counters.setdefault(name, (help, {}))[1]
+        values[labels] = values.get(labels, 0) + n
+
+    def gauge(self, name, help, fn, kind='gauge'):
+        """Registers a value read at scrape time; fn returns a number or {labels: number}."""
+        self.callbacks[name] = (help, kind, fn)
+
+    def summary(self, name, help):
+        if name not in self.summaries:
+            self.summaries[name] = (help, Summary())
+        return self.summaries[name][1]
+
+    def tick(self, interval):
+        """Closes a rate interval; call once per interval."""
+        for stats in self.sources.values():
+            stats.rate = stats.window / interval
+            stats.window = 0
+
+    def render(self):
+        lines = []
+
+        def metric(name, kind, help, samples):
+            name = f'{self.namespace}_{name}'
+            lines.append(f'# HELP {name} {help}')
+            lines.append(f'# TYPE {name} {kind}')
+            for labels, value in samples:
+                lines.append(f'{name}{{{labels}}} {value}' if labels else f'{name} {value}')
+
+        sources = [(f'gateway="{label_value(gateway)}",mac="{label_value(mac)}"', stats) for (gateway, mac), stats in sorted(self.sources.items())]
+        metric('source_received_total', 'counter', 'CSI records received per source.',
+               [(labels, stats.received) for labels, stats in sources])
+        metric('source_lost_total', 'counter', 'CSI records missing per source.',
+               [(labels, stats.lost) for labels, stats in sources])
+        metric('source_lost_air_total', 'counter', 'Sounding frames sent but never captured by the RX, per source.',
+               [(labels, stats.lost_air) for labels, stats in sources])
+        metric('source_lost_transport_total', 'counter', 'Records captured by the RX but lost on UART or network.',
+               [(labels, stats.lost_transport) for labels, stats in sources])
+        metric('source_loss_ratio', 'gauge', 'Fraction of records lost per source since start.',
+               [(labels, round(stats.loss_ratio, 6)) for labels, stats in sources])
+        metric('source_rate_hz', 'gauge', 'CSI records received per second over the last interval.',
+               [(labels, stats.rate) for labels, stats in sources])
+
+        for name, (help, values) in sorted(self.counters.items()):
+            metric(name, 'counter', help, sorted(values.items()))
+
+        for name, (help, kind, fn) in sorted(self.callbacks.items()):
+            value = fn()
+            metric(name, kind, help, sorted(value.items()) if isinstance(value, dict) else [('', value)])
+
+        for name, (help, summary) in sorted(self.summaries.items()):
+            metric(name, 'summary', help,
+                   [(f'quantile="{q}"', round(float(v), 6)) for q, v in summary.quantiles().items()])
+            lines.append(f'{self.namespace}_{name}_sum {summary.sum:.6f}')
+            lines.append(f'{self.namespace}_{name}_count {summary.count}')
+
+        return '\n'.join(lines) + '\n'
+
+
+async def start_http_server(metrics, host, port):
+    """Serves metrics.render() to any HTTP request, for servers without a web framework."""
+
+    async def handle(reader, writer):
+        try:
+            await reader.readuntil(b'\r\n\r\n')
+            body = metrics.render().encode()
+            writer.write(b'HTTP/1.1 200 OK\r\n'
+                         b'Content-Type: text/plain; version=0.0.4\r\n'
+                         b'Content-Length: %d\r\n'
+                         b'Connection: close\r\n\r\n' % len(body) + body)
+            await writer.drain()
+        except (asyncio.IncompleteReadError, asyncio.LimitOverrunError, ConnectionError):
+            pass
+        finally:
+            writer.close()
+
+    return await asyncio.start_server(handle, host, port)
@@ -0,0 +1,146 @@
+import mmap
+import os
+import threading
+from collections import OrderedDict
+from glob import glob
+
+import numpy as np
+
+
+SEGMENT_FORMAT = 'images-{:05d}.pack'
+INDEX_NAME = 'images.idx'
+SEGMENT_MAX_BYTES = 1 << 30
+# Appended frames per source that a repeat may still refer to.
+RECENT_PER_SOURCE = 16
+
+INDEX_DTYPE = np.dtype([
+    ('frame_id', '<u8'),
+    ('timestamp', '<f8'),
+    ('segment', '<u4'),
+    ('length', '<u4'),
+    ('offset', '<u8'),
+])
+
+
+def has_pack(session_dir):
+    return os.path.isfile(os.path.join(session_dir, INDEX_NAME))
+
+
+class PackWriter:
+    """Appends encoded frames unchanged to segment files of a session.
+
+    Each frame gets one fixed-size record in images.idx, written after its bytes,
+    so a torn write at the end of a crashed session is simply ignored by readers.
+    A repeated frame only gets an index record pointing at the bytes already stored.
+    """
+
+    def __init__(self, session_dir, segment_max_bytes=SEGMENT_MAX_BYTES):
+        self.session_dir = session_dir
+        self.segment_max_bytes = segment_max_bytes
+        self.lock = threading.Lock()
+
+        self.segment = len(glob(os.path.join(session_dir, 'images-*.pack')))
+        self.segment_file = None
+        self.offset = 0
+        self.recent = {}
+        self.index_file = open(os.path.join(session_dir, INDEX_NAME), 'ab')
+        self.open_segment()
+
+    def open_segment(self):
+        if self.segment_file is not None:
+            self.segment_file.close()
+        path = os.path.join(self.session_dir, SEGMENT_FORMAT.format(self.segment))
+        self.segment_file = open(path, 'ab')
+        self.offset = self.segment_file.tell()
+
+    def append(self, frame_id, timestamp, data, source=None, seq=None):
+        with self.lock:
+            if self.offset > 0 and self.offset + len(data) > self.segment_max_bytes:
+                self.segment += 1
+                self.open_segment()
+
+            self.segment_file.write(data)
+            self.segment_file.flush()
+
+            self.write_index(frame_id, timestamp, self.segment, len(data), self.offset)
+            if source is not None:
+                recent = self.recent.setdefault(source, OrderedDict())
+                recent[seq] = (self.segment, len(data), self.offset)
+                recent.move_to_end(seq)
+                if len(recent) > RECENT_PER_SOURCE:
+                    recent.popitem(last=False)
+
+            self.offset += len(data)
+
+    def repeat(self, frame_id, timestamp, source, seq):
+        """Indexes frame_id as another copy of frame seq, if it is among the last frames appended from source.
+
+        Writes run on a thread pool, so later frames from source may already have been appended.
+        """
+        with self.lock:
+            stored = self.recent.get(source, {}).get(seq)
+            if stored is None:
+                return False
+            self.write_index(frame_id, timestamp, *stored)
+            return True
+
+    def write_index(self, frame_id, timestamp, segment, length, offset):
+        record = np.array([(frame_id, timestamp, segment, length, offset)], dtype=INDEX_DTYPE)
+        self.index_file.write(record.tobytes())
+        self.index_file.flush()
+
+    def close(self):
+        with self.lock:
+            self.segment_file.close()
+            self.index_file.close()
+
+
+class PackReader:
+    """Random access to a session pack through read-only memory maps."""
+
+    def __init__(self, session_dir):
+        self.session_dir = session_dir
+
+        index_path = os.path.join(session_dir, INDEX_NAME)
+        count = os.path.getsize(index_path) // INDEX_DTYPE.itemsize
+        self.index = np.fromfile(index_path, dtype=INDEX_DTYPE, count=count)
+
+        self.order = np.argsort(self.index['frame_id'], kind='stable')
+        self.sorted_ids = self.index['frame_id'][self.order]
+        self.segments = {}
+
+    def __len__(self):
+        return len(self.index)
+
+    def __getitem__(self, position):
+        entry = self.index[position]
+        segment = self.get_segment(int(entry['segment']))
+        offset = int(entry['offset'])
+        return memoryview(segment)[offset:offset + int(entry['length'])]
+
+    @property
+    def frame_ids(self):
+        return self.index['frame_id']
+
+    def get_segment(self, segment):
+        if segment not in self.segments:
+            path = os.path.join(self.session_dir, SEGMENT_FORMAT.format(segment))
+            with open(path, 'rb') as f:
+                self.segments[segment] = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        return self.segments[segment]
+
+    def position(self, frame_id):
+        """Position of the last frame stored under frame_id, or None."""
+        i = np.searchsorted(self.sorted_ids, frame_id, side='right') - 1
+        if i < 0 or self.sorted_ids[i] != frame_id:
+            return None
+        return int(self.order[i])
+
+    def get(self, frame_id):
+        position = self.position(frame_id)
+        return None if position is None else self[position]
+
+    def close(self):
+        for segment in self.segments.values():
+            segment.close()
+        self.segments = {}
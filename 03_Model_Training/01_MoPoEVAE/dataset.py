@@ -1,17 +1,18 @@
-import json
 import math
 import os
-from glob import glob
+import sys
+from pathlib import Path
 
-import albumentations as A
-import pandas as pd
 import numpy as np
 import torch
-from skimage import io
 from tqdm import tqdm
 from torch.utils.data import Dataset
 from torchvision import transforms
 
+sys.path.append(str(Path(__file__).resolve().parent.parent))
+from common.image_cache import build_image_cache
+from common.dataset_index import build_session_index
+
 
 csi_valid_subcarrier_index = []
 csi_valid_subcarrier_index += [i for i in range(6, 32)]
@@ -37,26 +38,15 @@ class WificamDataset(Dataset):
         self.window_size_h = math.ceil(window_size / 2)
         self.frequence_len = frequence_len
 
-        self.compute_statistics()
-
-        data = pd.read_csv(os.path.join(data_dir, 'csi.csv'))
-        csi = data['data']
-        self.csi = np.zeros([len(csi), 256], dtype=np.float32)
+        self.image_cache = build_image_cache(data_dir)
+        self.image_ids = set(self.image_cache.valid_ids.tolist())
 
-        csi_complex = np.zeros([len(csi), CSI_SUBCARRIERS], dtype=np.complex64)
-        for i in range(len(csi)):
-            sample = np.array(json.loads(csi[i]), dtype=np.int64)
-            for j in range(len(sample)):
-                self.csi[i][j] = sample[j]
-            for j in range(CSI_SUBCARRIERS):
-                csi_complex[i][j] = complex(
-                    sample[csi_valid_subcarrier_index[j]*2],
-                    sample[csi_valid_subcarrier_index[j]*2-1]
-                )
-
-        self.ids = data['id']
+        self.compute_statistics()
 
-        self.csi_amplitudes = np.abs(csi_complex)
+        csi_index = build_session_index(data_dir)
+        self.csi = csi_index.raw
+        self.ids = csi_index.ids
+        self.csi_amplitudes = csi_index.amplitude
 
         self.data_size = len(self.csi_amplitudes) - self.window_size
 
@@ -65,9 +55,9 @@ class WificamDataset(Dataset):
         sum_channels = np.zeros(3, dtype=np.float64)
         sum_squares_channels = np.zeros(3, dtype=np.float64)
 
-        img_files = glob(os.path.join(self.data_dir, '*.png'))
-        for file in tqdm(img_files, desc="Computing Stats"):
-            img = io.imread(file).astype(np.float64)
+        rows = np.flatnonzero(self.image_cache.valid)
+        for row in tqdm(rows, desc="Computing Stats"):
+            img = self.image_cache[row].astype(np.float64)
             
             h, w, _ = img.shape
             num_pixels = h * w
@@ -93,7 +83,7 @@ class WificamDataset(Dataset):
     
     def __getitem__(self, index):
         index = index + self.window_size_h
-        spectrogram = self.csi_amplitudes[index-self.window_size_h:index+self.window_size_h-1]
+        spectrogram = np.array(self.csi_amplitudes[index-self.window_size_h:index+self.window_size_h-1])
         spectrogram = np.transpose(spectrogram, (1, 0))
 
         spectrogram_transforms = transforms.Compose([transforms.ToTensor()])
@@ -101,16 +91,12 @@ class WificamDataset(Dataset):
 
         image_ids = self.ids[index-self.window_size_h:index+self.window_size_h-1]
 
-        image_ids = [
-            id for id in image_ids
-            if os.path.isfile(os.path.join(self.data_dir, str(id) + '.png'))
-        ]
+        image_ids = [id for id in image_ids if id in self.image_ids]
 
         id = image_ids[len(image_ids)//2]
         image_index = image_ids.index(id)
 
-        image = io.imread(os.path.join(self.data_dir, str(id) + '.png'))
-        image = A.Resize(128, 128, always_apply=True)(image=image)['image']
+        image = self.image_cache[self.image_cache.row(id)]
         image = torch.tensor(image, dtype=torch.float) / 255.0
         image = image.permute(2, 0, 1)
         image = transforms.Normalize(self.normalized_mean, self.normalized_std)(image)
@@ -1,43 +1,35 @@
-import json, os, cv2
-import pandas as pd
+import sys
 import numpy as np
 import torch
 from torch.utils.data import Dataset
-from glob import glob
+from pathlib import Path
 
-CSI_VALID_SUBCARRIER_INDEX = [i for i in range(6, 32)] + [i for i in range(33, 59)]
-NUM_SUBCARRIERS = len(CSI_VALID_SUBCARRIER_INDEX)
+sys.path.append(str(Path(__file__).resolve().parent.parent))
+from common.image_cache import build_image_cache
+from common.dataset_index import build_session_index, find_sessions, NUM_SUBCARRIERS
 
 class WificamDataset(Dataset):
     def __init__(self, base_dir, window_size):
         self.base_dir, self.window_size = base_dir, window_size
-        self.csi_amplitudes, self.image_paths = [], []
+        self.sessions, self.samples = [], np.zeros((0, 3), dtype=np.int64)
         self.load_data()
     
     def load_data(self):
-        csv_paths = glob(os.path.join(self.base_dir, '**', 'csi.csv'), recursive=True)
-        for path in csv_paths:
-            d_dir = os.path.dirname(path)
-            df = pd.read_csv(path).sort_values('id')
-            raw = np.array([json.loads(x) for x in df['data'].values])
-            
-            real = raw[:, [i * 2 for i in CSI_VALID_SUBCARRIER_INDEX]]
-            imag = raw[:, [i * 2 - 1 for i in CSI_VALID_SUBCARRIER_INDEX]]
-            amp = np.sqrt(real**2 + imag**2).astype(np.float32)
-            
-            img_ids = sorted([int(os.path.basename(f).split('.')[0]) for f in glob(os.path.join(d_dir, '*.png'))])
-            img_ids = np.array(img_ids)
+        samples = []
+        for d_dir in find_sessions(self.base_dir):
+            cache = build_image_cache(d_dir)
+            if not cache.valid.any(): continue
+            index = build_session_index(d_dir)
+            rows = index.window_image_rows(self.window_size, cache, target='row')
+            samples.append(np.stack([np.full(len(rows), len(self.sessions)), np.arange(len(rows)), rows], axis=1))
+            self.sessions.append((index, cache))
+        if samples: self.samples = np.concatenate(samples)
 
-            for i in range(len(amp) - self.window_size):
-                target = df.iloc[i + self.window_size//2]['id']
-                best_img = img_ids[np.abs(img_ids - target).argmin()]
-                self.csi_amplitudes.append(amp[i:i+self.window_size])
-                self.image_paths.append(os.path.join(d_dir, f'{best_img}.png'))
-
-    def __len__(self): return len(self.image_paths)
+    def __len__(self): return len(self.samples)
     
     def __getitem__(self, idx):
-        csi = torch.from_numpy(self.csi_amplitudes[idx])
-        img = cv2.imread(self.image_paths[idx])
-        img = cv2.resize(cv2.cvtColor(img, cv2.COLOR_BGR2RGB), (128, 128))
+        session, start, row = self.samples[idx]
+        index, cache = self.sessions[session]
+        csi = torch.from_numpy(np.array(index.amplitude[start:start+self.window_size]))
+        img = np.array(cache[row])
         return csi, torch.from_numpy(img).permute(2, 0, 1).float() / 255.0
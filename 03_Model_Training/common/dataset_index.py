@@ -0,0 +1,136 @@
+import json
+import os
+
+import numpy as np
+import pandas as pd
+
+from common.image_cache import CACHE_DIR
+
+
+CSI_VALID_SUBCARRIER_INDEX = [i for i in range(6, 32)] + [i for i in range(33, 59)]
+NUM_SUBCARRIERS = len(CSI_VALID_SUBCARRIER_INDEX)
+INDEX_VERSION = 1
+
+
+def find_sessions(base_dir):
+    sessions = []
+    for root, dirs, files in os.walk(base_dir):
+        dirs[:] = [d for d in dirs if d != CACHE_DIR]
+        if 'csi.csv' in files:
+            sessions.append(root)
+    return sorted(sessions)
+
+
+def csi_signature(session_dir):
+    stat = os.stat(os.path.join(session_dir, 'csi.csv'))
+    return [INDEX_VERSION, stat.st_size, stat.st_mtime_ns]
+
+
+def nearest(sorted_values, targets):
+    """Position of the closest value for each target; ties go to the smaller value."""
+    if len(sorted_values) == 1:
+        return np.zeros(len(targets), dtype=np.int64)
+    right = np.clip(np.searchsorted(sorted_values, targets), 1, len(sorted_values) - 1)
+    left = right - 1
+    take_left = (targets - sorted_values[left]) <= (sorted_values[right] - targets)
+    return np.where(take_left, left, right)
+
+
+def load_json(path):
+    if not os.path.isfile(path):
+        return None
+    with open(path) as f:
+        return json.load(f)
+
+
+class SessionIndex:
+    """Parsed CSI of one session, sorted by id and stored beside the image cache.
+
+    Amplitudes and raw CSI are memory-mapped on first access; as with ImageCache,
+    only the paths are pickled.
+    """
+
+    def __init__(self, session_dir):
+        self.cache_dir = os.path.join(session_dir, CACHE_DIR)
+        self.ids = np.load(os.path.join(self.cache_dir, 'csi_ids.npy'))
+        self.signature = load_json(os.path.join(self.cache_dir, 'csi.json'))['signature']
+        self.arrays = {}
+
+    def __len__(self):
+        return len(self.ids)
+
+    def __getstate__(self):
+        state = self.__dict__.copy()
+        state['arrays'] = {}
+        return state
+
+    def array(self, name):
+        if name not in self.arrays:
+            self.arrays[name] = np.load(os.path.join(self.cache_dir, f'csi_{name}.npy'), mmap_mode='r')
+        return self.arrays[name]
+
+    @property
+    def amplitude(self):
+        return self.array('amplitude')
+
+    @property
+    def raw(self):
+        return self.array('raw')
+
+    def window_image_rows(self, window_size, image_cache, target='value'):
+        """Image cache row for every window start, persisted per window size.
+
+        target='value' pairs a window with the image nearest to ids[i] + window_size // 2,
+        target='row' with the one nearest to ids[i + window_size // 2].
+        """
+        name = f'windows_{window_size}_{target}'
+        path = os.path.join(self.cache_dir, name + '.npy')
+        meta_path = os.path.join(self.cache_dir, name + '.json')
+        signature = {'csi': self.signature, 'images': image_cache.signature}
+
+        meta = load_json(meta_path)
+        if meta is not None and meta.get('signature') == signature:
+            return np.load(path)
+
+        num_windows = max(len(self.ids) - window_size, 0)
+        if target == 'value':
+            targets = self.ids[:num_windows] + window_size // 2
+        else:
+            targets = self.ids[window_size // 2:window_size // 2 + num_windows]
+
+        valid_rows = np.flatnonzero(image_cache.valid)
+        rows = valid_rows[nearest(image_cache.ids[valid_rows], targets)]
+
+        np.save(path, rows)
+        with open(meta_path, 'w') as f:
+            json.dump({'signature': signature}, f)
+        return rows
+
+
+def build_session_index(session_dir):
+    """Parses csi.csv into the session index unless it is already up to date."""
+    cache_dir = os.path.join(session_dir, CACHE_DIR)
+    meta_path = os.path.join(cache_dir, 'csi.json')
+    signature = csi_signature(session_dir)
+
+    meta = load_json(meta_path)
+    if meta is not None and meta.get('signature') == signature:
+        return SessionIndex(session_dir)
+
+    os.makedirs(cache_dir, exist_ok=True)
+    if meta is not None:
+        os.remove(meta_path)
+
+    df = pd.read_csv(os.path.join(session_dir, 'csi.csv')).sort_values(by='id', kind='stable')
+    raw = np.array([json.loads(x) for x in df['data'].values], dtype=np.int8).reshape(len(df), -1)
+    real = raw[:, [i * 2 for i in CSI_VALID_SUBCARRIER_INDEX]].astype(np.int32)
+    imag = raw[:, [i * 2 - 1 for i in CSI_VALID_SUBCARRIER_INDEX]].astype(np.int32)
+    amplitude = np.sqrt(real**2 + imag**2).astype(np.float32)
+
+    np.save(os.path.join(cache_dir, 'csi_ids.npy'), df['id'].values.astype(np.int64))
+    np.save(os.path.join(cache_dir, 'csi_raw.npy'), raw)
+    np.save(os.path.join(cache_dir, 'csi_amplitude.npy'), amplitude)
+    with open(meta_path, 'w') as f:
+        json.dump({'signature': signature, 'count': len(df)}, f)
+
+    return SessionIndex(session_dir)
@@ -0,0 +1,152 @@
+import json
+import os
+import sys
+from concurrent.futures import ProcessPoolExecutor
+from glob import glob
+from pathlib import Path
+
+import numpy as np
+import cv2
+
+# The collection server writes the packs; reading them goes through the same module.
+sys.path.append(str(Path(__file__).resolve().parents[2] / '02_Server' / 'common'))
+from pack_store import PackReader, has_pack, INDEX_NAME
+
+
+CACHE_DIR = '.cache'
+IMAGE_SIZE = 128
+CHUNK_SIZE = 256
+
+
+def list_images(session_dir):
+    """Image ids of a session and where to read them from, sorted by id."""
+    if has_pack(session_dir):
+        ids = np.asarray(PackReader(session_dir).frame_ids, dtype=np.int64)
+        order = np.argsort(ids, kind='stable')
+        # Like PNG files named by id, a later frame with the same id replaces the earlier one.
+        last = np.append(ids[order][1:] != ids[order][:-1], True)
+        order = order[last]
+        return ids[order], [int(i) for i in order]
+
+    paths = {}
+    for path in glob(os.path.join(session_dir, '*.png')):
+        try:
+            paths[int(os.path.basename(path).split('.')[0])] = path
+        except ValueError:
+            continue
+    ids = np.array(sorted(paths), dtype=np.int64)
+    return ids, [paths[i] for i in ids]
+
+
+def source_signature(session_dir):
+    if has_pack(session_dir):
+        stat = os.stat(os.path.join(session_dir, INDEX_NAME))
+        return ['pack', stat.st_size, stat.st_mtime_ns]
+
+    # The directory mtime catches frames that are added, removed or renamed; a frame
+    # overwritten in place only changes its own mtime, so the newest one is kept too.
+    mtimes = [os.stat(path).st_mtime_ns for path in glob(os.path.join(session_dir, '*.png'))]
+    return ['png', os.stat(session_dir).st_mtime_ns, len(mtimes), max(mtimes, default=0)]
+
+
+def decode_chunk(session_dir, cache_path, start, sources, size):
+    images = np.load(cache_path, mmap_mode='r+')
+    pack = PackReader(session_dir) if has_pack(session_dir) else None
+
+    valid = np.zeros(len(sources), dtype=bool)
+    for i, source in enumerate(sources):
+        if pack is not None:
+            image = cv2.imdecode(np.frombuffer(pack[source], np.uint8), cv2.IMREAD_COLOR)
+        else:
+            image = cv2.imread(source)
+        if image is None:
+            continue
+        image = cv2.cvtColor(image, cv2.COLOR_BGR2RGB)
+        images[start + i] = cv2.resize(image, (size, size))
+        valid[i] = True
+
+    images.flush()
+    if pack is not None:
+        pack.close()
+    return start, valid
+
+
+class ImageCache:
+    """Decoded, resized RGB images of one session as a uint8 NHWC memmap.
+
+    Only the paths are pickled, so DataLoader workers reopen the map themselves
+    instead of receiving a copy of the whole array.
+    """
+
+    def __init__(self, session_dir, size=IMAGE_SIZE):
+        prefix = os.path.join(session_dir, CACHE_DIR, f'images_{size}')
+        self.images_path = prefix + '.npy'
+        self.ids = np.load(prefix + '_ids.npy')
+        self.valid = np.load(prefix + '_valid.npy')
+        with open(prefix + '.json') as f:
+            self.signature = json.load(f)['signature']
+        self.images = None
+
+    def __len__(self):
+        return len(self.ids)
+
+    def __getitem__(self, row):
+        if self.images is None:
+            self.images = np.load(self.images_path, mmap_mode='r')
+        return self.images[row]
+
+    def __getstate__(self):
+        state = self.__dict__.copy()
+        state['images'] = None
+        return state
+
+    @property
+    def valid_ids(self):
+        return self.ids[self.valid]
+
+    def row(self, image_id):
+        return int(np.searchsorted(self.ids, image_id))
+
+
+def build_image_cache(session_dir, size=IMAGE_SIZE, workers=None):
+    """Decodes every image of a session once, unless the cache is newer than its source."""
+    cache_dir = os.path.join(session_dir, CACHE_DIR)
+    prefix = os.path.join(cache_dir, f'images_{size}')
+    meta_path = prefix + '.json'
+    os.makedirs(cache_dir, exist_ok=True)
+    signature = source_signature(session_dir)
+
+    if os.path.isfile(meta_path):
+        with open(meta_path) as f:
+            if json.load(f).get('signature') == signature:
+                return ImageCache(session_dir, size)
+
+    if os.path.isfile(meta_path):
+        os.remove(meta_path)
+
+    ids, sources = list_images(session_dir)
+    cache_path = prefix + '.npy'
+    if len(ids) == 0:
+        np.save(cache_path, np.zeros((0, size, size, 3), dtype=np.uint8))
+    else:
+        images = np.lib.format.open_memmap(cache_path, mode='w+', dtype=np.uint8, shape=(len(ids), size, size, 3))
+        del images
+
+    valid = np.zeros(len(ids), dtype=bool)
+    with ProcessPoolExecutor(max_workers=workers or os.cpu_count()) as pool:
+        futures = [
+            pool.submit(decode_chunk, session_dir, cache_path, start, sources[start:start + CHUNK_SIZE], size)
+            for start in range(0, len(ids), CHUNK_SIZE)
+        ]
+        for future in futures:
+            start, chunk_valid = future.result()
+            valid[start:start + len(chunk_valid)] = chunk_valid
+
+    np.save(prefix + '_ids.npy', ids)
+    np.save(prefix + '_valid.npy', valid)
+    with open(meta_path, 'w') as f:
+        json.dump({'signature': signature, 'count': len(ids), 'size': size}, f)
+
+    if not valid.all():
+        print(f'Warning: {(~valid).sum()} unreadable images in {session_dir}.')
+    return ImageCache(session_dir, size)
@@ -207,7 +207,7 @@ btnApply.addEventListener('click', async () => {
         await new Promise(r => setTimeout(r, 50));
     }
 
-    errors === 0 ? log("Success. Please reboot.", 'log-sys') : log(`Finished with ${errors} errors.`, 'log-err');
+    errors === 0 ? log("Success. Settings applied.", 'log-sys') : log(`Finished with ${errors} errors.`, 'log-err');
     updateUI('READY');
 });
 